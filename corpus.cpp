@@ -0,0 +1,95 @@
+#include "corpus.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+/**
+ * @brief Сгенерировать набор данных (всегда один и тот же для одних и тех же параметров)
+ * random - равномерные байты, zipf - байты с частотами по закону Ципфа,
+ * text - английские слова, text2 - слова из пар байтов (для кодов по парам), single - один символ,
+ * all256 - все 256 байтов с геометрически убывающими частотами
+ * @param corpus Имя набора
+ * @param size Размер в байтах
+ * @return std::string Набор данных
+ */
+std::string Corpus::generate(const std::string& corpus, std::size_t size)
+{
+    std::mt19937_64 rng(size);
+    std::string data;
+    data.reserve(size + 16);
+
+    const auto weighted = [&](const std::vector<double>& weights)
+    {
+        std::discrete_distribution<unsigned> dist(weights.begin(), weights.end());
+        while (data.size() < size)
+            data += static_cast<char>(dist(rng));
+    };
+
+    std::vector<double> weights(256);
+    if (corpus == "random")
+    {
+        std::uniform_int_distribution<unsigned> dist(0, 255);
+        while (data.size() < size)
+            data += static_cast<char>(dist(rng));
+    }
+    else if (corpus == "zipf")
+    {
+        for (unsigned s = 0; s < 256; ++s)
+            weights[s] = 1.0 / (s + 1);
+
+        weighted(weights);
+    }
+    else if (corpus == "text")
+    {
+        static const char* const words[] = {
+            "the", "of", "and", "to", "a", "in", "is", "it", "you", "that", "he", "was", "for", "on", "are",
+            "with", "as", "I", "his", "they", "be", "at", "one", "have", "this", "from", "or", "had", "by",
+            "word", "but", "what", "some", "we", "can", "out", "other", "were", "all", "there", "when", "up",
+            "use", "your", "how", "said", "an", "each", "she", "which", "do", "their", "time", "if", "will",
+            "way", "about", "many", "then", "them", "write", "would", "like", "so", "these", "her", "long",
+            "make", "thing", "see", "him", "two", "has", "look", "more", "day", "could", "go", "come", "did",
+            "number", "sound", "no", "most", "people", "my", "over", "know", "water", "than", "call", "first"
+        };
+        const std::size_t count = sizeof(words) / sizeof(words[0]);
+
+        std::vector<double> wordWeights(count);
+        for (std::size_t w = 0; w < count; ++w)
+            wordWeights[w] = 1.0 / (w + 1);
+
+        std::discrete_distribution<std::size_t> word(wordWeights.begin(), wordWeights.end());
+        std::uniform_int_distribution<unsigned> punctuation(0, 15);
+        while (data.size() < size)
+        {
+            data += words[word(rng)];
+            const auto p = punctuation(rng);
+            data += p == 0 ? ".\n" : p == 1 ? ", " : " ";
+        }
+    }
+    else if (corpus == "text2")
+    {
+        static const char* const pairs[] = { "ab", "cd", "ef", "gh", "ij", "kl", "mn", "op" };
+        std::uniform_int_distribution<std::size_t> pair(0, 7);
+        while (data.size() < size)
+            data += pairs[pair(rng)];
+    }
+    else if (corpus == "single")
+    {
+        data.assign(size, 'a');
+    }
+    else
+    {
+        // Сначала по разу каждый байт, чтобы в наборе были все 256
+        for (unsigned s = 0; s < 256 && data.size() < size; ++s)
+            data += static_cast<char>(s);
+
+        for (unsigned s = 0; s < 256; ++s)
+            weights[s] = std::pow(0.97, s);
+
+        weighted(weights);
+    }
+
+    data.resize(size);
+
+    return data;
+}
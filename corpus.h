@@ -0,0 +1,17 @@
+#ifndef HUFFMAN_CORPUS_H
+#define HUFFMAN_CORPUS_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Сгенерированные наборы данных для замера скорости и тестов
+ * Один генератор на всех: замер скорости и дифференциальная проверка гоняют одни и те же данные
+ */
+class Corpus
+{
+public:
+    static std::string generate(const std::string& corpus, std::size_t size);
+};
+
+#endif
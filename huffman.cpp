@@ -0,0 +1,3597 @@
+#include "huffman.h"
+
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GNUC__)
+#define HUFFMAN_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define HUFFMAN_ALWAYS_INLINE inline
+#endif
+
+// Сбор Huffman::Stats: по умолчанию выключен и вырезается при компиляции
+#ifndef HUFFMAN_STATS
+#define HUFFMAN_STATS 0
+#endif
+
+// Собирается ли Stats, без HUFFMAN_STATS все замеры вырезаются
+static constexpr bool kStatsEnabled = HUFFMAN_STATS != 0;
+
+// Счетчик выделений памяти, заданный программой через setAllocationCounter
+static std::atomic<Huffman::AllocationCounter> allocationCounter{ nullptr };
+
+/**
+ * @brief Сколько выделений памяти насчитал счетчик программы
+ * @return std::uint64_t Показание счетчика или 0, если счетчик не задан
+ */
+static std::uint64_t allocations()
+{
+    const auto counter = allocationCounter.load(std::memory_order_relaxed);
+    return counter ? counter() : 0;
+}
+
+/**
+ * @brief Создать пул
+ * @param threads Сколько потоков всего участвует в работе, включая вызывающий
+ */
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    for (std::size_t t = 1; t < threads; ++t)
+        m_workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_wake.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+/**
+ * @brief Выполнить task(i) для всех i из [0, count) и дождаться завершения
+ * Вызовы из разных потоков (например, из контекстов разных потоков сервиса с общим пулом)
+ * выполняются по очереди
+ * @param count Количество задач
+ * @param task Задача
+ * @throw Первое исключение, выброшенное задачей
+ */
+void ThreadPool::parallelFor(std::size_t count, const std::function<void(std::size_t)>& task)
+{
+    if (m_workers.empty() || count <= 1)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            task(i);
+
+        return;
+    }
+
+    const std::lock_guard<std::mutex> caller(m_callers);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_active = m_workers.size();
+        m_error = nullptr;
+        ++m_generation;
+    }
+
+    m_wake.notify_all();
+    runTasks();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_active == 0; });
+        m_task = nullptr;
+        error = m_error;
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * @brief Цикл потока пула: ждать новую порцию задач и разбирать ее
+ */
+void ThreadPool::work()
+{
+    std::uint64_t seen = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+        if (m_stop)
+            return;
+
+        seen = m_generation;
+
+        lock.unlock();
+        runTasks();
+        lock.lock();
+
+        if (--m_active == 0)
+            m_done.notify_one();
+    }
+}
+
+/**
+ * @brief Забирать задачи по одной, пока они не кончатся
+ */
+void ThreadPool::runTasks()
+{
+    while (true)
+    {
+        const auto i = m_next++;
+        if (i >= m_count)
+            return;
+
+        try
+        {
+            (*m_task)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+    }
+}
+
+/**
+ * @brief Закодировать текст
+ * @param text Текст для закодирования
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ * @return std::string Закодированный текст
+ */
+std::string Huffman::encode(std::string_view text, ThreadPool* pool)
+{
+    return encode(text, Settings(), pool);
+}
+
+/**
+ * @brief Закодировать текст
+ * @param text Текст для закодирования
+ * @param settings Параметры кодирования
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ * @param stats Счетчики, в которые добавляется статистика кодирования, или nullptr
+ * @return std::string Закодированный текст
+ */
+std::string Huffman::encode(std::string_view text, const Settings& settings, ThreadPool* pool, Stats* stats)
+{
+    std::string encoded;
+
+    Encoder encoder(settings, pool);
+    encoder.setStats(stats);
+    encoder.setContentSize(text.size());
+    encoder.update(text, encoded);
+    encoder.finish(encoded);
+
+    return encoded;
+}
+
+
+/**
+ * @brief Декодировать текст с помощью канонических кодов Хаффмана
+ * @param text Закодированный текст
+ * @param pool Пул потоков для параллельного декодирования блоков или nullptr
+ * @param stats Счетчики, в которые добавляется статистика декодирования, или nullptr
+ * @return std::string Декодированный текст
+ */
+std::string Huffman::decode(std::string_view text, ThreadPool* pool, Stats* stats)
+{
+    std::string decoded;
+
+    Decoder decoder(pool);
+    decoder.setStats(stats);
+    decoder.update(text, decoded);
+    decoder.finish(decoded);
+
+    return decoded;
+}
+
+/**
+ * @brief Наибольший размер закодированного текста с параметрами по умолчанию
+ * @param size Длина текста
+ * @return std::size_t Размер буфера, которого заведомо хватит для encode
+ */
+std::size_t Huffman::maxEncodedSize(std::size_t size)
+{
+    return maxEncodedSize(size, Settings());
+}
+
+/**
+ * @brief Наибольший размер закодированного текста
+ * Несжимаемые блоки хранятся как есть, поэтому текст растет не больше чем на
+ * kMaxBlockOverhead байт на блок
+ * @param size Длина текста
+ * @param settings Параметры кодирования
+ * @return std::size_t Размер буфера, которого заведомо хватит для encode
+ */
+std::size_t Huffman::maxEncodedSize(std::size_t size, const Settings& settings)
+{
+    const auto blockSize = std::max<std::size_t>(1, std::min(settings.blockSize, kMaxBlockSize));
+
+    return kMaxStreamOverhead + size + (size + blockSize - 1) / blockSize * kMaxBlockOverhead;
+}
+
+/**
+ * @brief Закодировать текст в буфер вызывающего с параметрами по умолчанию
+ * @param text Текст для закодирования
+ * @param out Буфер
+ * @param capacity Размер буфера, с запасом хватает maxEncodedSize(text.size())
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ * @return std::size_t Размер закодированного текста
+ * @throw std::runtime_error Если буфер мал
+ */
+std::size_t Huffman::encode(std::string_view text, char* out, std::size_t capacity, ThreadPool* pool)
+{
+    return encode(text, out, capacity, Settings(), pool);
+}
+
+/**
+ * @brief Закодировать текст в буфер вызывающего
+ * Контекст свой у каждого потока и переживает вызов, поэтому
+ * после первых вызовов память больше не выделяется
+ * @param text Текст для закодирования
+ * @param out Буфер
+ * @param capacity Размер буфера, с запасом хватает maxEncodedSize(text.size(), settings)
+ * @param settings Параметры кодирования
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ * @return std::size_t Размер закодированного текста
+ * @throw std::runtime_error Если буфер мал
+ */
+std::size_t Huffman::encode(std::string_view text, char* out, std::size_t capacity, const Settings& settings, ThreadPool* pool)
+{
+    thread_local Context context;
+
+    context.reset(settings, pool);
+
+    return context.encode(text, out, capacity);
+}
+
+/**
+ * @brief Декодировать текст в буфер вызывающего
+ * Блоки декодируются прямо в буфер. Контекст свой у каждого потока и переживает вызов,
+ * поэтому после первых вызовов память больше не выделяется
+ * @param text Закодированный текст
+ * @param out Буфер
+ * @param capacity Размер буфера, хватает decodedSize(text)
+ * @param pool Пул потоков для параллельного декодирования блоков или nullptr
+ * @return std::size_t Длина декодированного текста
+ * @throw std::runtime_error Если текст поврежден или буфер мал
+ */
+std::size_t Huffman::decode(std::string_view text, char* out, std::size_t capacity, ThreadPool* pool)
+{
+    thread_local Context context;
+
+    context.reset(Settings(), pool);
+
+    return context.decode(text, out, capacity);
+}
+
+/**
+ * @brief Узнать длину декодированного текста по заголовку потока
+ * @param text Закодированный текст, достаточно его начала
+ * @return std::uint64_t Длина декодированного текста
+ * @throw std::runtime_error Если это не закодированный текст, версия не поддерживается или длина в нем не записана
+ */
+std::uint64_t Huffman::decodedSize(std::string_view text)
+{
+    if (text.compare(0, kMagicSize, kMagic) != 0 || text.size() <= kMagicSize)
+        throw std::runtime_error("Can not decode not encoded text.");
+
+    // Как в readStreamHeader: длину из потока неизвестной версии читать нельзя
+    const auto version = static_cast<unsigned char>(text[kMagicSize]);
+    if (version < kMinFormatVersion || version > kFormatVersion)
+        throw std::runtime_error("Unsupported encoded format version.");
+
+    std::size_t i = kMagicSize + 1;
+    const auto size = version >= 2 ? getVarint(text, i) : 0;
+    if (size == 0)
+        throw std::runtime_error("Encoded text has no decoded size.");
+
+    return size - 1;
+}
+
+/**
+ * @brief Создать контекст с параметрами по умолчанию
+ * @param pool Пул потоков для параллельной обработки блоков или nullptr
+ */
+Huffman::Context::Context(ThreadPool* pool)
+    : Context(Settings(), pool)
+{
+}
+
+/**
+ * @brief Создать контекст
+ * @param settings Параметры кодирования
+ * @param pool Пул потоков для параллельной обработки блоков или nullptr
+ */
+Huffman::Context::Context(const Settings& settings, ThreadPool* pool)
+    : m_settings(settings)
+    , m_pool(pool)
+    , m_encoder(settings, pool)
+    , m_decoder(pool)
+{
+}
+
+/**
+ * @brief Сменить параметры кодирования и пул, сохранив выделенную память
+ * @param settings Параметры кодирования
+ * @param pool Пул потоков для параллельной обработки блоков или nullptr
+ */
+void Huffman::Context::reset(const Settings& settings, ThreadPool* pool)
+{
+    m_settings = settings;
+    m_pool = pool;
+}
+
+/**
+ * @brief Накапливать статистику всех следующих вызовов
+ * @param stats Счетчики или nullptr
+ */
+void Huffman::Context::setStats(Stats* stats)
+{
+    m_encoder.setStats(stats);
+    m_decoder.setStats(stats);
+}
+
+/**
+ * @brief Закодировать текст во внутренний буфер контекста
+ * @param text Текст для закодирования
+ * @return std::string_view Закодированный текст, действителен до следующего вызова контекста
+ */
+std::string_view Huffman::Context::encode(std::string_view text)
+{
+    m_encoder.reset(m_settings, m_pool);
+    m_buffer.clear();
+
+    m_encoder.setContentSize(text.size());
+    m_encoder.update(text, m_buffer);
+    m_encoder.finish(m_buffer);
+
+    return m_buffer;
+}
+
+/**
+ * @brief Закодировать текст прямо в буфер вызывающего
+ * Заголовок, блоки и конец потока пишутся в out без промежуточной строки контекста
+ * @param text Текст для закодирования
+ * @param out Буфер
+ * @param capacity Размер буфера, с запасом хватает maxEncodedSize(text.size(), settings())
+ * @return std::size_t Размер закодированного текста
+ * @throw std::runtime_error Если буфер мал; за его конец ничего не пишется
+ */
+std::size_t Huffman::Context::encode(std::string_view text, char* out, std::size_t capacity)
+{
+    m_encoder.reset(m_settings, m_pool);
+
+    return m_encoder.encodeInto(text, out, capacity);
+}
+
+/**
+ * @brief Декодировать текст во внутренний буфер контекста
+ * @param text Закодированный текст
+ * @return std::string_view Декодированный текст, действителен до следующего вызова контекста
+ * @throw std::runtime_error Если текст поврежден
+ */
+std::string_view Huffman::Context::decode(std::string_view text)
+{
+    m_decoder.reset(m_pool);
+    m_buffer.clear();
+
+    m_decoder.update(text, m_buffer);
+    m_decoder.finish(m_buffer);
+
+    return m_buffer;
+}
+
+/**
+ * @brief Декодировать текст прямо в буфер вызывающего
+ * @param text Закодированный текст
+ * @param out Буфер
+ * @param capacity Размер буфера, хватает decodedSize(text)
+ * @return std::size_t Длина декодированного текста
+ * @throw std::runtime_error Если текст поврежден или буфер мал
+ */
+std::size_t Huffman::Context::decode(std::string_view text, char* out, std::size_t capacity)
+{
+    m_decoder.reset(m_pool);
+
+    return m_decoder.decodeInto(text, out, capacity);
+}
+
+/**
+ * @brief Закодировать короткое сообщение по словарю
+ * Формат: номер словаря, длина текста (оба varint) и один битовый поток
+ * @param text Текст для закодирования
+ * @param dictionary Словарь
+ * @return std::string Закодированное сообщение
+ */
+std::string Huffman::encode(std::string_view text, const Dictionary& dictionary)
+{
+    std::string encoded;
+    putVarint(encoded, dictionary.m_id);
+    putVarint(encoded, text.size());
+
+    // Размер потока не больше, чем по самому длинному коду на символ, лишнее обрезаем
+    const auto header = encoded.size();
+    encoded.resize(header + (text.size() * dictionary.m_maxLength + 7) / 8);
+
+    const auto end = emitStream(text, dictionary.m_codes, &encoded[0] + header);
+    encoded.resize(static_cast<std::size_t>(end - encoded.data()));
+
+    return encoded;
+}
+
+/**
+ * @brief Декодировать часть текста, не декодируя весь поток
+ * Декодируются только блоки, которые накрывают [offset, offset + length). Блоки находятся
+ * по индексу из конца потока (Settings::seekIndex), а без него - обходом заголовков блоков.
+ * Текст читается только в заголовках, индексе и нужных блоках: тела остальных блоков
+ * не читаются, поэтому у отображенного в память файла чтение стоит несколько байт на блок
+ * и O(length), а не O(размер файла)
+ * @param text Закодированный текст, один поток целиком
+ * @param offset Смещение части в декодированном тексте
+ * @param length Длина части, обрезается по концу текста
+ * @param pool Пул потоков для параллельного декодирования блоков или nullptr
+ * @return std::string Часть декодированного текста
+ * @throw std::runtime_error Если текст поврежден или offset за концом текста
+ */
+std::string Huffman::decodeRange(std::string_view text, std::uint64_t offset, std::size_t length, ThreadPool* pool)
+{
+    std::uint64_t flags;
+    const auto first = readStreamHeader(text, flags);
+
+    const bool checksums = (flags & kChecksumFlag) != 0;
+    std::vector<SeekPoint> points;
+    if (flags & kSeekIndexFlag)
+        readSeekIndex(text, first, points);
+    else
+        scanSeekPoints(text, first, points);
+
+    const auto total = points.empty() ? 0 : points.back().offset + points.back().count;
+    if (offset > total)
+        throw std::runtime_error("Range is out of decoded text.");
+
+    length = static_cast<std::size_t>(std::min<std::uint64_t>(length, total - offset));
+    const auto end = offset + length;
+
+    std::string decoded(length, '\0');
+    if (length == 0)
+        return decoded;
+
+    // Первый блок, который кончается после offset, и первый, который начинается не раньше end
+    const auto begin = std::upper_bound(points.begin(), points.end(), offset, [](std::uint64_t value, const SeekPoint& point)
+    {
+        return value < point.offset + point.count;
+    });
+    const auto last = std::lower_bound(begin, points.end(), end, [](const SeekPoint& point, std::uint64_t value)
+    {
+        return point.offset < value;
+    });
+    const auto firstBlock = static_cast<std::size_t>(begin - points.begin());
+
+    // Целые блоки декодируются прямо на место, крайние - во временный буфер
+    const auto task = [&](std::size_t k)
+    {
+        const auto& point = points[firstBlock + k];
+        const auto from = std::max(point.offset, offset);
+        const auto to = std::min(point.offset + point.count, end);
+        char* dst = &decoded[static_cast<std::size_t>(from - offset)];
+
+        if (from == point.offset && to == point.offset + point.count)
+        {
+            decodeSeekBlock(text, points, firstBlock + k, checksums, dst);
+            return;
+        }
+
+        thread_local std::string partial;
+        partial.resize(point.count);
+        decodeSeekBlock(text, points, firstBlock + k, checksums, &partial[0]);
+        std::memcpy(dst, partial.data() + (from - point.offset), static_cast<std::size_t>(to - from));
+    };
+
+    const auto blocks = static_cast<std::size_t>(last - begin);
+    if (pool)
+        pool->parallelFor(blocks, task);
+    else
+        for (std::size_t k = 0; k < blocks; ++k)
+            task(k);
+
+    return decoded;
+}
+
+/**
+ * @brief Разобрать заголовок потока
+ * @param text Закодированный текст
+ * @param flags Флаги потока, у версий до 3 - 0
+ * @return std::size_t Позиция первого блока
+ * @throw std::runtime_error Если это не закодированный текст или версия не поддерживается
+ */
+std::size_t Huffman::readStreamHeader(std::string_view text, std::uint64_t& flags)
+{
+    if (text.size() <= kMagicSize || text.compare(0, kMagicSize, kMagic) != 0)
+        throw std::runtime_error("Can not decode not encoded text.");
+
+    const auto version = static_cast<unsigned char>(text[kMagicSize]);
+    if (version < kMinFormatVersion || version > kFormatVersion)
+        throw std::runtime_error("Unsupported encoded format version.");
+
+    std::size_t i = kMagicSize + 1;
+    if (version >= 2)
+        getVarint(text, i);
+
+    flags = version >= 3 ? getVarint(text, i) : 0;
+    if (flags & ~kKnownFlags)
+        throw std::runtime_error("Unsupported encoded stream flags.");
+
+    return i;
+}
+
+/**
+ * @brief Прочитать заголовок блока и найти его тело
+ * @param text Закодированный текст
+ * @param position Позиция заголовка блока, после чтения - позиция следующего блока
+ * @param count Длина текста блока, 0 - конец потока
+ * @return std::string_view Тело блока, у конца потока пустое
+ * @throw std::runtime_error Если блок поврежден
+ */
+std::string_view Huffman::readBlock(std::string_view text, std::size_t& position, std::uint64_t& count)
+{
+    count = getVarint(text, position);
+    if (count == 0)
+        return {};
+
+    const auto size = getVarint(text, position);
+    if (count > kMaxBlockSize || size > 8 * count + 512 || size == 0 || size > text.size() - position)
+        throw std::runtime_error("Invalid encoded block.");
+
+    const auto body = text.substr(position, static_cast<std::size_t>(size));
+    position += static_cast<std::size_t>(size);
+
+    return body;
+}
+
+/**
+ * @brief Прочитать индекс блоков из конца потока
+ * Последние 8 байт - размер индекса, перед индексом - блок конца потока.
+ * Каждая запись сверяется с заголовком блока на своей позиции, поэтому запись не может
+ * указать внутрь тела другого блока
+ * @param text Закодированный текст
+ * @param first Позиция первого блока
+ * @param points Блоки потока
+ * @throw std::runtime_error Если индекс поврежден
+ */
+void Huffman::readSeekIndex(std::string_view text, std::size_t first, std::vector<SeekPoint>& points)
+{
+    if (text.size() < first + 1 + 8)
+        throw std::runtime_error("Invalid seek index.");
+
+    std::uint64_t size = 0;
+    for (unsigned b = 0; b < 8; ++b)
+        size |= std::uint64_t(static_cast<unsigned char>(text[text.size() - 8 + b])) << (8 * b);
+
+    const auto index = text.substr(0, text.size() - 8);
+    if (size == 0 || size > index.size() - first - 1)
+        throw std::runtime_error("Invalid seek index.");
+
+    auto i = index.size() - static_cast<std::size_t>(size);
+    const auto endMarker = i - 1;
+    if (index[endMarker] != 0)
+        throw std::runtime_error("Invalid seek index.");
+
+    const auto blocks = getVarint(index, i);
+    if (blocks > index.size() - i)
+        throw std::runtime_error("Invalid seek index.");
+
+    std::uint64_t offset = 0;
+    std::size_t position = first;
+    for (std::size_t b = 0; b < blocks; ++b)
+    {
+        const auto count = getVarint(index, i);
+        const auto bytes = getVarint(index, i);
+        const auto back = getVarint(index, i);
+        if (count == 0 || count > kMaxBlockSize || bytes > endMarker - position || back > b)
+            throw std::runtime_error("Invalid seek index.");
+
+        auto next = position;
+        std::uint64_t blockCount;
+        readBlock(text, next, blockCount);
+        if (blockCount != count || next - position != bytes)
+            throw std::runtime_error("Invalid seek index.");
+
+        points.push_back(SeekPoint{ offset, static_cast<std::size_t>(count), position, back ? b - static_cast<std::size_t>(back) : kNoSeekPoint });
+        offset += count;
+        position += static_cast<std::size_t>(bytes);
+    }
+
+    if (i != index.size() || position != endMarker)
+        throw std::runtime_error("Invalid seek index.");
+}
+
+/**
+ * @brief Найти блоки потока обходом их заголовков, тела блоков пропускаются
+ * @param text Закодированный текст
+ * @param first Позиция первого блока
+ * @param points Блоки потока
+ * @throw std::runtime_error Если поток поврежден
+ */
+void Huffman::scanSeekPoints(std::string_view text, std::size_t first, std::vector<SeekPoint>& points)
+{
+    std::uint64_t offset = 0;
+    std::size_t position = first;
+    std::size_t lengths = kNoSeekPoint;
+    while (true)
+    {
+        const auto start = position;
+        std::uint64_t count;
+        const auto body = readBlock(text, position, count);
+        if (count == 0)
+            return;
+
+        const auto type = static_cast<unsigned char>(body[0]);
+        if (type == SingleStreamBlock || type == FourStreamBlock)
+            lengths = points.size();
+
+        points.push_back(SeekPoint{ offset, static_cast<std::size_t>(count), start, (type & kReuseTableFlag) ? lengths : kNoSeekPoint });
+        offset += count;
+    }
+}
+
+/**
+ * @brief Декодировать один блок, найденный readSeekIndex или scanSeekPoints
+ * Блоку с флагом kReuseTableFlag длины кодов берутся из заголовка блока, на который он ссылается.
+ * Блок декодируется целиком, поэтому и контрольная сумма сверяется по всему его тексту
+ * @param text Закодированный текст
+ * @param points Блоки потока
+ * @param b Номер блока
+ * @param checksums В потоке есть контрольные суммы блоков (kChecksumFlag)
+ * @param out Место под текст блока
+ * @throw std::runtime_error Если блок поврежден или его текст не сошелся с контрольной суммой
+ */
+void Huffman::decodeSeekBlock(std::string_view text, const std::vector<SeekPoint>& points, std::size_t b, bool checksums, char* out)
+{
+    auto position = points[b].position;
+    std::uint64_t count;
+    auto body = readBlock(text, position, count);
+    if (count != points[b].count)
+        throw std::runtime_error("Invalid seek index.");
+
+    const auto blockChecksum = checksums ? takeChecksum(body) : 0;
+    if (body.empty())
+        throw std::runtime_error("Invalid encoded block.");
+
+    const auto type = static_cast<unsigned char>(body[0]);
+    std::size_t start = 1;
+    CodeLengths lengths{};
+    if (type == RawBlock || type == RunBlock)
+    {
+        if (body.size() - 1 != (type == RawBlock ? count : 1))
+            throw std::runtime_error("Invalid encoded block.");
+    }
+    else if (type & kReuseTableFlag)
+    {
+        if (points[b].lengths == kNoSeekPoint)
+            throw std::runtime_error("Invalid encoded block.");
+
+        auto source = points[points[b].lengths].position;
+        std::uint64_t sourceCount;
+        const auto sourceBody = readBlock(text, source, sourceCount);
+        if (sourceCount == 0 || sourceBody.empty())
+            throw std::runtime_error("Invalid seek index.");
+
+        const auto sourceType = static_cast<unsigned char>(sourceBody[0]);
+        if (sourceType != SingleStreamBlock && sourceType != FourStreamBlock)
+            throw std::runtime_error("Invalid seek index.");
+
+        std::size_t i = 1;
+        lengths = readCodeLengths(sourceBody, i);
+    }
+    else if (type != ContextBlock && type != WideBlock)
+    {
+        lengths = readCodeLengths(body, start);
+    }
+
+    decodeBlock(static_cast<unsigned char>(type & ~kReuseTableFlag), lengths, body.substr(start), points[b].count, out);
+
+    if (checksums && checksum(std::string_view(out, points[b].count)) != blockChecksum)
+        throw std::runtime_error("Block checksum mismatch.");
+}
+
+/**
+ * @brief Декодировать сообщение, закодированное по словарю
+ * @param text Закодированное сообщение
+ * @param dictionary Словарь, которым сообщение закодировано
+ * @return std::string Декодированный текст
+ * @throw std::runtime_error Если сообщение закодировано другим словарем или повреждено
+ */
+std::string Huffman::decode(std::string_view text, const Dictionary& dictionary)
+{
+    std::size_t i = 0;
+    if (getVarint(text, i) != dictionary.m_id)
+        throw std::runtime_error("Message is encoded with another dictionary.");
+
+    const auto count = getVarint(text, i);
+    if (count > 8 * (text.size() - i))
+        throw std::runtime_error("Invalid encoded message.");
+
+    std::string decoded(count, '\0');
+
+    BitReader reader(text.data() + i, text.size() - i);
+    for (std::size_t n = 0; n < count; ++n)
+        decoded[n] = decodeSymbol<char>(reader, dictionary.m_table);
+
+    return decoded;
+}
+
+/**
+ * @brief Узнать номер словаря, которым закодировано сообщение
+ * @param text Закодированное сообщение
+ * @return std::uint32_t Номер словаря
+ * @throw std::runtime_error Если сообщение повреждено
+ */
+std::uint32_t Huffman::dictionaryId(std::string_view text)
+{
+    std::size_t i = 0;
+    const auto id = getVarint(text, i);
+    if (id > UINT32_MAX)
+        throw std::runtime_error("Invalid encoded message.");
+
+    return static_cast<std::uint32_t>(id);
+}
+
+/**
+ * @brief Обучить словарь на образце
+ * @param sample Образец сообщений
+ * @param id Номер словаря
+ * @param maxCodeLength Наибольшая длина кода
+ * @return Huffman::Dictionary Словарь
+ */
+Huffman::Dictionary Huffman::Dictionary::train(std::string_view sample, std::uint32_t id, unsigned maxCodeLength)
+{
+    return train(buildHistogram(sample.data(), sample.size()), id, maxCodeLength);
+}
+
+/**
+ * @brief Обучить словарь по гистограмме образца
+ * Байтам, которых нет в образце, тоже достается код: сообщения могут их содержать
+ * @param histogram Гистограмма образца
+ * @param id Номер словаря
+ * @param maxCodeLength Наибольшая длина кода, прижимается к допустимым пределам
+ * @return Huffman::Dictionary Словарь
+ */
+Huffman::Dictionary Huffman::Dictionary::train(const Histogram& histogram, std::uint32_t id, unsigned maxCodeLength)
+{
+    Histogram counts = histogram;
+    for (auto& count : counts)
+        ++count;
+
+    maxCodeLength = std::max(kMinCodeLengthLimit, std::min(maxCodeLength, kMaxCodeLengthLimit));
+    const auto huffmanCode = generateHuffmanCodes(generateHuffmanTree(counts), maxCodeLength);
+
+    CodeLengths lengths;
+    for (unsigned s = 0; s < 256; ++s)
+        lengths[s] = huffmanCode[s].length;
+
+    return Dictionary(id, lengths);
+}
+
+/**
+ * @brief Загрузить словарь, сохраненный serialize
+ * Длины кодов проверяются так же, как в заголовке блока: сумма Крафта должна быть ровно 1.
+ * Код должен быть у каждого из 256 байтов, как у обученного словаря: байт без кода
+ * encode закодировал бы пустым кодом, и он пропал бы из сообщения
+ * @param data Сохраненный словарь
+ * @return Huffman::Dictionary Словарь
+ * @throw std::runtime_error Если данные повреждены, у какого-то байта нет кода
+ * или длины не образуют полный префиксный код
+ */
+Huffman::Dictionary Huffman::Dictionary::load(std::string_view data)
+{
+    if (data.compare(0, 3, "hed") != 0)
+        throw std::runtime_error("Invalid dictionary.");
+
+    std::size_t i = 3;
+    const auto id = getVarint(data, i);
+    const auto lengths = readCodeLengths(data, i);
+
+    if (id > UINT32_MAX || i != data.size())
+        throw std::runtime_error("Invalid dictionary.");
+
+    for (const auto length : lengths)
+        if (length == 0)
+            throw std::runtime_error("Invalid dictionary.");
+
+    // Длины и сумму Крафта проверяет generateCanonicalCodes в конструкторе
+    return Dictionary(static_cast<std::uint32_t>(id), lengths);
+}
+
+/**
+ * @brief Сохранить словарь: метка "hed", номер (varint) и длины кодов
+ * @return std::string Сохраненный словарь
+ */
+std::string Huffman::Dictionary::serialize() const
+{
+    std::string data = "hed";
+    putVarint(data, m_id);
+    writeCodeLengths(data, m_codes);
+
+    return data;
+}
+
+/**
+ * @brief Собрать словарь по длинам кодов: коды для кодирования и таблицу декодирования
+ * @param id Номер словаря
+ * @param lengths Длины кодов символов
+ * @throw std::runtime_error Если в словаре нет ни одного кода или длины не образуют полный префиксный код
+ */
+Huffman::Dictionary::Dictionary(std::uint32_t id, const CodeLengths& lengths)
+    : m_id(id)
+    , m_codes{}
+{
+    std::vector<CodeWord> codes;
+    generateCanonicalCodes(lengths, codes);
+    if (codes.empty())
+        throw std::runtime_error("Invalid dictionary.");
+
+    for (const auto& code : codes)
+    {
+        m_codes[code.symbol] = Code{ static_cast<std::uint32_t>(code.bits), static_cast<std::uint8_t>(code.length) };
+        m_maxLength = std::max(m_maxLength, code.length);
+    }
+
+    buildDecodeTable(codes, m_table);
+}
+
+/**
+ * @brief Начать учет вызова
+ * @param stats Счетчики или nullptr
+ * @param bytesIn Сколько байт пришло на вход
+ * @param out Строка, в которую вызов дописывает результат
+ */
+template <typename Output>
+Huffman::StatsScope<Output>::StatsScope(Stats* stats, std::size_t bytesIn, const Output& out)
+    : m_stats(stats)
+    , m_out(out)
+    , m_outSize(out.size())
+    , m_allocations(kStatsEnabled && stats ? allocations() : 0)
+{
+    if constexpr (kStatsEnabled)
+        if (m_stats)
+            m_stats->bytesIn += bytesIn;
+}
+
+/**
+ * @brief Добавить к счетчикам выход и выделения памяти за вызов
+ */
+template <typename Output>
+Huffman::StatsScope<Output>::~StatsScope()
+{
+    if constexpr (kStatsEnabled)
+    {
+        if (m_stats)
+        {
+            m_stats->bytesOut += m_out.size() - std::min(m_outSize, m_out.size());
+            m_stats->allocations += allocations() - m_allocations;
+        }
+    }
+}
+
+/**
+ * @brief Выполнить function и добавить ее время к фазе stats->*phase
+ * Без HUFFMAN_STATS или без stats только выполняет function
+ * @param stats Счетчики или nullptr
+ * @param phase Счетчик времени фазы
+ * @param function Замеряемая функция
+ */
+template <typename Function>
+void Huffman::measure(Stats* stats, std::uint64_t Stats::*phase, Function&& function)
+{
+    if constexpr (kStatsEnabled)
+    {
+        if (stats)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            function();
+            stats->*phase += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            return;
+        }
+    }
+
+    function();
+}
+
+/**
+ * @brief Создать потоковый кодировщик с параметрами по умолчанию
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ */
+Huffman::Encoder::Encoder(ThreadPool* pool)
+    : Encoder(Settings(), pool)
+{
+}
+
+/**
+ * @brief Создать потоковый кодировщик
+ * @param settings Параметры кодирования, выходящие за допустимые пределы значения прижимаются к ним
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ */
+Huffman::Encoder::Encoder(const Settings& settings, ThreadPool* pool)
+{
+    reset(settings, pool);
+}
+
+/**
+ * @brief Начать новый поток с другими параметрами, сохранив выделенную память
+ * @param settings Параметры кодирования, выходящие за допустимые пределы значения прижимаются к ним
+ * @param pool Пул потоков для параллельного кодирования блоков или nullptr
+ */
+void Huffman::Encoder::reset(const Settings& settings, ThreadPool* pool)
+{
+    m_settings = settings;
+    m_settings.blockSize = std::max<std::size_t>(1, std::min(m_settings.blockSize, kMaxBlockSize));
+    m_settings.maxCodeLength = std::max(kMinCodeLengthLimit, std::min(m_settings.maxCodeLength, kMaxCodeLengthLimit));
+    m_settings.order = std::min(m_settings.order, 1u);
+    m_settings.symbolWidth = m_settings.symbolWidth == 2 ? 2 : 1;
+
+    m_pool = pool;
+    m_block.clear();
+    m_pending.clear();
+    m_hasPrevious = false;
+    m_index.clear();
+    m_blockCount = 0;
+    m_hasContentSize = false;
+    m_started = false;
+}
+
+/**
+ * @brief Сообщить длину всего текста до первого update, она запишется в заголовок потока
+ * @param size Длина всего текста
+ */
+void Huffman::Encoder::setContentSize(std::uint64_t size)
+{
+    m_contentSize = size;
+    m_hasContentSize = true;
+}
+
+/**
+ * @brief Закодировать очередную порцию входа
+ * Готовые блоки дописываются в out, неполный блок копится до следующего вызова
+ * @param data Порция входа
+ * @param out Строка, в которую дописывается закодированный поток
+ */
+void Huffman::Encoder::update(std::string_view data, std::string& out)
+{
+    const StatsScope scope(m_stats, data.size(), out);
+    write(data, out);
+}
+
+/**
+ * @brief Закодировать текст целиком в буфер вызывающего
+ * @param text Текст
+ * @param out Буфер
+ * @param capacity Размер буфера
+ * @return std::size_t Размер закодированного текста
+ * @throw std::runtime_error Если буфер мал
+ */
+std::size_t Huffman::Encoder::encodeInto(std::string_view text, char* out, std::size_t capacity)
+{
+    OutputBuffer buffer(out, capacity);
+    const StatsScope scope(m_stats, text.size(), buffer);
+
+    setContentSize(text.size());
+    write(text, buffer);
+    writeEnd(buffer);
+
+    return buffer.size();
+}
+
+/**
+ * @brief Закодировать порцию входа: тело update
+ * @param data Порция входа
+ * @param out Строка или буфер, в который дописывается закодированный поток
+ */
+template <typename Output>
+void Huffman::Encoder::write(std::string_view data, Output& out)
+{
+    start(out);
+
+    // Сначала дополняем накопленный блок
+    if (!m_block.empty())
+    {
+        const auto take = std::min(data.size(), m_settings.blockSize - m_block.size());
+        m_block.append(data.data(), take);
+        data.remove_prefix(take);
+
+        if (m_block.size() < m_settings.blockSize)
+            return;
+
+        m_pending.push_back(m_block);
+    }
+
+    // Целые блоки кодируем прямо из входа, без копирования
+    while (data.size() >= m_settings.blockSize)
+    {
+        m_pending.push_back(data.substr(0, m_settings.blockSize));
+        data.remove_prefix(m_settings.blockSize);
+    }
+
+    encodeBlocks(out);
+    m_block.assign(data.data(), data.size());
+}
+
+/**
+ * @brief Закодировать остаток входа и записать конец потока
+ * @param out Строка, в которую дописывается закодированный поток
+ */
+void Huffman::Encoder::finish(std::string& out)
+{
+    const StatsScope scope(m_stats, 0, out);
+    writeEnd(out);
+}
+
+/**
+ * @brief Закодировать остаток входа и записать конец потока: тело finish
+ * @param out Строка или буфер, в который дописывается закодированный поток
+ */
+template <typename Output>
+void Huffman::Encoder::writeEnd(Output& out)
+{
+    start(out);
+
+    if (!m_block.empty())
+    {
+        m_pending.push_back(m_block);
+        encodeBlocks(out);
+        m_block.clear();
+    }
+
+    // Блок нулевой длины - конец потока, следующий поток начинается со своих кодов
+    putVarint(out, 0);
+    m_hasPrevious = false;
+
+    // Индекс: число блоков, записи блоков и размер всего индекса (8 байт, младший первым),
+    // по которому индекс находится с конца потока
+    if (m_settings.seekIndex)
+    {
+        const auto start = out.size();
+        putVarint(out, m_blockCount);
+        out += m_index;
+
+        const auto size = static_cast<std::uint64_t>(out.size() - start);
+        for (unsigned b = 0; b < 8; ++b)
+            out += static_cast<char>(size >> (8 * b));
+
+        m_index.clear();
+        m_blockCount = 0;
+    }
+
+    m_hasContentSize = false;
+    m_started = false;
+}
+
+/**
+ * @brief Записать метку, версию формата и длину текста перед первым блоком
+ * @param out Строка или буфер, в который дописывается закодированный поток
+ */
+template <typename Output>
+void Huffman::Encoder::start(Output& out)
+{
+    if (!m_started)
+    {
+        out.append(kMagic, kMagicSize);
+        out += static_cast<char>(kFormatVersion);
+        putVarint(out, m_hasContentSize ? m_contentSize + 1 : 0);
+        putVarint(out, (m_settings.seekIndex ? kSeekIndexFlag : 0) | (m_settings.checksum ? kChecksumFlag : 0));
+        m_started = true;
+    }
+}
+
+/**
+ * @brief Закодировать накопленные блоки (параллельно, если есть пул) и дописать их по порядку
+ * Гистограммы и сами коды пишутся параллельно, а выбор кодов идет по порядку блоков:
+ * блок может взять коды предыдущего, и тогда дерево для него не строится
+ * @param out Строка или буфер, в который дописывается закодированный поток
+ */
+template <typename Output>
+void Huffman::Encoder::encodeBlocks(Output& out)
+{
+    if (m_results.size() < m_pending.size())
+        m_results.resize(m_pending.size());
+
+    if (m_plans.size() < m_pending.size())
+        m_plans.resize(m_pending.size());
+
+    const auto run = [this](const std::function<void(std::size_t)>& task)
+    {
+        if (m_pool)
+            m_pool->parallelFor(m_pending.size(), task);
+        else
+            for (std::size_t b = 0; b < m_pending.size(); ++b)
+                task(b);
+    };
+
+    measure(m_stats, &Stats::histogramNs, [&]
+    {
+        run([this](std::size_t b)
+        {
+            m_plans[b].histograms = countBlock(m_pending[b], m_settings);
+            if (m_settings.order == 1)
+                planContext(m_pending[b], m_settings.maxCodeLength, m_plans[b].context);
+            if (m_settings.symbolWidth == 2)
+                planWide(m_pending[b], m_settings.maxCodeLength, m_plans[b].wide);
+        });
+    });
+
+    for (std::size_t b = 0; b < m_pending.size(); ++b)
+        planBlock(m_pending[b], m_plans[b]);
+
+    measure(m_stats, &Stats::emitNs, [&]
+    {
+        run([this](std::size_t b)
+        {
+            encodeBlock(m_pending[b], m_plans[b], m_results[b]);
+            if (m_settings.checksum)
+                putChecksum(m_results[b], checksum(m_pending[b]));
+        });
+    });
+
+    if constexpr (kStatsEnabled)
+    {
+        if (m_stats)
+        {
+            for (std::size_t b = 0; b < m_pending.size(); ++b)
+            {
+                const auto& plan = m_plans[b];
+                ++m_stats->blocks;
+                m_stats->storedBlocks += plan.type == RawBlock || plan.type == RunBlock;
+                m_stats->reusedTables += plan.reuseTable;
+                m_stats->contextBlocks += plan.type == ContextBlock;
+                m_stats->wideBlocks += plan.type == WideBlock;
+                m_stats->sampledBlocks += plan.histograms.sampled;
+
+                for (unsigned s = 0; s < 256 && !plan.histograms.sampled; ++s)
+                {
+                    const auto count = plan.histograms.total[s];
+                    if (!count)
+                        continue;
+
+                    m_stats->symbols.set(s);
+                    if (plan.type == RawBlock || plan.type == RunBlock || plan.type == ContextBlock || plan.type == WideBlock)
+                        continue;
+
+                    m_stats->maxCodeLength = std::max<unsigned>(m_stats->maxCodeLength, plan.huffmanCode[s].length);
+                    m_stats->codedSymbols += count;
+                    m_stats->codedBits += count * plan.huffmanCode[s].length;
+                }
+            }
+        }
+    }
+
+    for (std::size_t b = 0; b < m_pending.size(); ++b)
+    {
+        const auto start = out.size();
+        putVarint(out, m_pending[b].size());
+        putVarint(out, m_results[b].size());
+        out += m_results[b];
+
+        // Запись индекса: длина текста, размер блока с заголовком и на сколько блоков назад
+        // лежат длины кодов блока, взявшего коды предыдущего (0 - длины не нужны или свои)
+        if (m_settings.seekIndex)
+        {
+            const auto& plan = m_plans[b];
+            const bool ownLengths = (plan.type == SingleStreamBlock || plan.type == FourStreamBlock) && !plan.reuseTable;
+            if (ownLengths)
+                m_lengthsBlock = m_blockCount;
+
+            putVarint(m_index, m_pending[b].size());
+            putVarint(m_index, out.size() - start);
+            putVarint(m_index, plan.reuseTable ? m_blockCount - m_lengthsBlock : 0);
+            ++m_blockCount;
+        }
+    }
+
+    m_pending.clear();
+}
+
+/**
+ * @brief Выбрать тип блока и его коды
+ * Модель порядка 1 и коды по парам байтов берутся, только если они короче лучшего
+ * из вариантов с кодами байтов. Свои коды блока запоминаются для следующих блоков
+ * @param block Блок текста
+ * @param plan Гистограммы блока (и модели, включенные в настройках), сюда же записывается выбор
+ */
+void Huffman::Encoder::planBlock(std::string_view block, BlockPlan& plan)
+{
+    auto bits = planOrder0(block, plan);
+    const auto orderType = plan.type;
+
+    if (m_settings.order == 1 && orderType != RunBlock && plan.context.bits < bits)
+    {
+        plan.type = ContextBlock;
+        bits = plan.context.bits;
+    }
+
+    if (m_settings.symbolWidth == 2 && orderType != RunBlock && plan.wide.bits < bits)
+        plan.type = WideBlock;
+
+    if (plan.type == ContextBlock || plan.type == WideBlock)
+    {
+        plan.reuseTable = false;
+        return;
+    }
+
+    // Блок по выборке может при записи стать RawBlock, поэтому его коды не берет никто. Коды блоков
+    // до него тоже: если он записан с кодами, у декодера предыдущими станут уже они
+    if (plan.type != RawBlock && plan.type != RunBlock && !plan.reuseTable)
+    {
+        m_previous = plan.huffmanCode;
+        m_hasPrevious = !plan.histograms.sampled;
+    }
+}
+
+/**
+ * @brief Выбрать тип блока и его коды по гистограмме, без контекстов
+ * Блок из одного символа записывается самим символом. Если даже оценка снизу для своих кодов
+ * не меньше исходного текста, блок хранится как есть и дерево не строится.
+ * Иначе берутся коды предыдущего блока или свои, смотря что короче
+ * @param block Блок текста
+ * @param plan Гистограммы блока, сюда же записывается выбор
+ * @return std::uint64_t Размер выбранного варианта в битах
+ */
+std::uint64_t Huffman::Encoder::planOrder0(std::string_view block, BlockPlan& plan)
+{
+    const auto& histogram = plan.histograms.total;
+    const auto rawBits = 8 * static_cast<std::uint64_t>(block.size());
+
+    plan.type = plan.histograms.streams == 4 ? FourStreamBlock : SingleStreamBlock;
+    plan.reuseTable = false;
+
+    // В гистограмме по выборке есть все символы, так что однородность проверяется по самому блоку
+    const bool run = plan.histograms.sampled
+        ? block.find_first_not_of(block[0]) == std::string_view::npos
+        : histogram[static_cast<unsigned char>(block[0])] == block.size();
+    if (run)
+    {
+        plan.type = RunBlock;
+        return 8;
+    }
+
+    const bool canReuse = m_hasPrevious && !plan.histograms.sampled;
+    if (canReuse && canReuseTable(histogram, m_previous) && codedBits(histogram, m_previous) < rawBits)
+    {
+        plan.reuseTable = true;
+        plan.huffmanCode = m_previous;
+        return codedBits(histogram, m_previous);
+    }
+
+    // Коды предыдущего блока не лучше оценки снизу, значит и хранение как есть лучше их
+    if (lowerBoundBits(histogram) >= static_cast<double>(rawBits))
+    {
+        plan.type = RawBlock;
+        return rawBits;
+    }
+
+    Tree tree;
+    measure(m_stats, &Stats::treeNs, [&] { tree = generateHuffmanTree(histogram); });
+    measure(m_stats, &Stats::codesNs, [&] { plan.huffmanCode = generateHuffmanCodes(tree, m_settings.maxCodeLength); });
+
+    // Оценка снизу не решила - сравниваем точные размеры с заголовком своих кодов
+    if (canReuse && preferReusedTable(histogram, m_previous, plan.huffmanCode))
+    {
+        const auto reuseBits = codedBits(histogram, m_previous);
+        plan.reuseTable = reuseBits < rawBits;
+        plan.type = plan.reuseTable ? plan.type : RawBlock;
+        plan.huffmanCode = m_previous;
+        return std::min(reuseBits, rawBits);
+    }
+
+    const auto freshBits = codedBits(histogram, plan.huffmanCode) + 8 * codeLengthsSize(plan.huffmanCode);
+    if (freshBits >= rawBits)
+    {
+        plan.type = RawBlock;
+        return rawBits;
+    }
+
+    return freshBits;
+}
+
+/**
+ * @brief Создать потоковый декодировщик
+ * @param pool Пул потоков для параллельного декодирования блоков или nullptr
+ */
+Huffman::Decoder::Decoder(ThreadPool* pool)
+    : m_pool(pool)
+{
+}
+
+/**
+ * @brief Начать новый поток, сохранив выделенную память
+ * @param pool Пул потоков для параллельного декодирования блоков или nullptr
+ */
+void Huffman::Decoder::reset(ThreadPool* pool)
+{
+    m_pool = pool;
+    m_buffer.clear();
+    m_lengths.clear();
+    m_hasExpected = false;
+    m_decoded = 0;
+    m_started = false;
+    m_finished = false;
+}
+
+/**
+ * @brief Декодировать очередную порцию закодированного потока
+ * Все блоки, которые пришли целиком, декодируются и дописываются в out
+ * @param data Порция закодированного потока
+ * @param out Строка, в которую дописывается декодированный текст
+ * @throw std::runtime_error Если поток поврежден
+ */
+void Huffman::Decoder::update(std::string_view data, std::string& out)
+{
+    const StatsScope scope(m_stats, data.size(), out);
+
+    // Пока ничего не накоплено - разбираем блоки прямо из входа и сохраняем только хвост
+    if (m_buffer.empty())
+    {
+        const auto used = decodeBlocks(data, out);
+        m_buffer.assign(data.data() + used, data.size() - used);
+        return;
+    }
+
+    m_buffer.append(data.data(), data.size());
+    const auto used = decodeBlocks(m_buffer, out);
+    m_buffer.erase(0, used);
+}
+
+/**
+ * @brief Проверить, что поток закончился ровно на блоке конца потока
+ * Декодированный текст к этому моменту уже весь отдан в update, out не меняется
+ * @param out Строка с декодированным текстом
+ * @throw std::runtime_error Если поток оборван
+ */
+void Huffman::Decoder::finish(std::string& out)
+{
+    static_cast<void>(out);
+
+    if (!m_buffer.empty())
+        throw std::runtime_error("Unexpected end of encoded text.");
+
+    finishStream();
+}
+
+/**
+ * @brief Проверить конец потока и длину текста из заголовка, подготовиться к следующему потоку
+ * @throw std::runtime_error Если поток оборван или длина не совпала
+ */
+void Huffman::Decoder::finishStream()
+{
+    if (!m_finished)
+        throw std::runtime_error("Unexpected end of encoded text.");
+
+    if (m_hasExpected && m_decoded != m_expected)
+        throw std::runtime_error("Decoded size does not match encoded header.");
+
+    m_lengths.clear();
+    m_hasExpected = false;
+    m_decoded = 0;
+    m_started = false;
+    m_finished = false;
+}
+
+/**
+ * @brief Декодировать все целые блоки из начала data
+ * @param data Накопленный закодированный поток
+ * @param out Строка, в которую дописывается декодированный текст
+ * @return std::size_t Сколько байт data разобрано
+ * @throw std::runtime_error Если поток поврежден
+ */
+std::size_t Huffman::Decoder::decodeBlocks(std::string_view data, std::string& out)
+{
+    std::size_t total = out.size();
+    const auto used = scanBlocks(data, total);
+
+    // Блоки независимы, каждый пишет в свой участок out
+    out.resize(total);
+    decodeScanned(&out[0]);
+
+    return used;
+}
+
+/**
+ * @brief Декодировать весь поток в буфер вызывающего
+ * @param data Закодированный поток целиком
+ * @param out Буфер
+ * @param capacity Размер буфера
+ * @return std::size_t Длина декодированного текста
+ * @throw std::runtime_error Если поток поврежден или буфер мал
+ */
+std::size_t Huffman::Decoder::decodeInto(std::string_view data, char* out, std::size_t capacity)
+{
+    const StatsScope scope(m_stats, data.size(), m_buffer);
+
+    std::size_t total = 0;
+    if (scanBlocks(data, total) != data.size())
+        throw std::runtime_error("Unexpected end of encoded text.");
+
+    if (total > capacity)
+        throw std::runtime_error("Output buffer is too small.");
+
+    decodeScanned(out);
+    finishStream();
+
+    return total;
+}
+
+/**
+ * @brief Найти все целые блоки в начале data и место под их текст
+ * @param data Накопленный закодированный поток
+ * @param total Смещение текста первого блока, после поиска - конец текста последнего
+ * @return std::size_t Сколько байт data разобрано
+ * @throw std::runtime_error Если поток поврежден
+ */
+std::size_t Huffman::Decoder::scanBlocks(std::string_view data, std::size_t& total)
+{
+    std::size_t i = 0;
+
+    // В начале должны быть метка, версия формата и длина текста
+    if (!m_started)
+    {
+        if (data.size() < kMagicSize + 1)
+            return 0;
+
+        if (data.compare(0, kMagicSize, kMagic) != 0)
+            throw std::runtime_error("Can not decode not encoded text.");
+
+        const auto version = static_cast<unsigned char>(data[kMagicSize]);
+        if (version < kMinFormatVersion || version > kFormatVersion)
+            throw std::runtime_error("Unsupported encoded format version.");
+
+        i = kMagicSize + 1;
+
+        std::uint64_t size = 0;
+        if (version >= 2 && !tryGetVarint(data, i, size))
+            return 0;
+
+        std::uint64_t flags = 0;
+        if (version >= 3 && !tryGetVarint(data, i, flags))
+            return 0;
+
+        if (flags & ~kKnownFlags)
+            throw std::runtime_error("Unsupported encoded stream flags.");
+
+        m_hasIndex = (flags & kSeekIndexFlag) != 0;
+        m_hasChecksums = (flags & kChecksumFlag) != 0;
+        m_hasExpected = size != 0;
+        m_expected = size - 1;
+        m_started = true;
+    }
+
+    // Блок: длина текста, размер кодированного блока, сам блок.
+    // Сначала только находим целые блоки и место под их текст
+    m_blocks.clear();
+
+    // От прошлой порции нужны только последние длины кодов
+    if (m_lengths.size() > 1)
+        m_lengths.erase(m_lengths.begin(), m_lengths.end() - 1);
+    measure(m_stats, &Stats::headerNs, [&]
+    {
+        while (!m_finished)
+        {
+            std::size_t pos = i;
+            std::uint64_t count;
+            if (!tryGetVarint(data, pos, count))
+                break;
+
+            if (count == 0)
+            {
+                // Индекс нужен только decodeRange, здесь он лишь пропускается целиком
+                if (m_hasIndex && !skipSeekIndex(data, pos))
+                    break;
+
+                m_finished = true;
+                i = pos;
+                break;
+            }
+
+            std::uint64_t size;
+            if (!tryGetVarint(data, pos, size))
+                break;
+
+            if (count > kMaxBlockSize || size > 8 * count + 512)
+                throw std::runtime_error("Invalid encoded block.");
+
+            if (m_hasExpected && count > m_expected - m_decoded)
+                throw std::runtime_error("Decoded size does not match encoded header.");
+
+            if (data.size() - pos < size)
+                break;
+
+            // Длины кодов читаем сразу: по ним же декодируются следующие блоки с флагом kReuseTableFlag
+            auto body = data.substr(pos, size);
+            const auto blockChecksum = m_hasChecksums ? takeChecksum(body) : 0;
+            if (body.empty())
+                throw std::runtime_error("Invalid encoded block.");
+
+            const auto type = static_cast<unsigned char>(body[0]);
+            std::size_t start = 1;
+            if (type == RawBlock || type == RunBlock)
+            {
+                if (body.size() - 1 != (type == RawBlock ? count : 1))
+                    throw std::runtime_error("Invalid encoded block.");
+            }
+            else if (type == ContextBlock || type == WideBlock)
+            {
+                // Таблицы кодов лежат в самом блоке и разбираются при декодировании
+            }
+            else if (type & kReuseTableFlag)
+            {
+                if (m_lengths.empty())
+                    throw std::runtime_error("Invalid encoded block.");
+            }
+            else
+            {
+                m_lengths.push_back(readCodeLengths(body, start));
+            }
+
+            if constexpr (kStatsEnabled)
+            {
+                if (m_stats)
+                {
+                    ++m_stats->blocks;
+                    m_stats->storedBlocks += type == RawBlock || type == RunBlock;
+                    m_stats->reusedTables += (type & kReuseTableFlag) != 0;
+                    m_stats->contextBlocks += type == ContextBlock;
+                    m_stats->wideBlocks += type == WideBlock;
+
+                    if (type == RunBlock)
+                        m_stats->symbols.set(static_cast<unsigned char>(body[1]));
+
+                    for (unsigned s = 0; s < 256 && type != RawBlock && type != RunBlock && type != ContextBlock && type != WideBlock; ++s)
+                    {
+                        if (m_lengths.back()[s])
+                            m_stats->symbols.set(s);
+
+                        m_stats->maxCodeLength = std::max<unsigned>(m_stats->maxCodeLength, m_lengths.back()[s]);
+                    }
+                }
+            }
+
+            // Блоки без кодов ссылаются на любые длины, лишь бы номер был допустимым
+            if (m_lengths.empty())
+                m_lengths.emplace_back();
+
+            m_blocks.push_back(Block{ static_cast<unsigned char>(type & ~kReuseTableFlag), m_lengths.size() - 1, body.substr(start), static_cast<std::size_t>(count), total, blockChecksum });
+            total += count;
+            m_decoded += count;
+            i = pos + size;
+        }
+    });
+
+    if (m_finished && i != data.size())
+        throw std::runtime_error("Unexpected data after end of encoded text.");
+
+    return i;
+}
+
+/**
+ * @brief Пропустить индекс блоков за концом потока
+ * @param data Накопленный закодированный поток
+ * @param pos Позиция индекса, после пропуска - позиция за ним
+ * @return bool Пришел ли индекс целиком
+ * @throw std::runtime_error Если индекс поврежден
+ */
+bool Huffman::Decoder::skipSeekIndex(std::string_view data, std::size_t& pos)
+{
+    std::size_t i = pos;
+    std::uint64_t blocks;
+    if (!tryGetVarint(data, i, blocks))
+        return false;
+
+    for (std::uint64_t k = 0; k < 3 * blocks; ++k)
+    {
+        std::uint64_t value;
+        if (!tryGetVarint(data, i, value))
+            return false;
+    }
+
+    if (data.size() - i < 8)
+        return false;
+
+    std::uint64_t size = 0;
+    for (unsigned b = 0; b < 8; ++b)
+        size |= std::uint64_t(static_cast<unsigned char>(data[i + b])) << (8 * b);
+
+    if (size != i - pos)
+        throw std::runtime_error("Invalid seek index.");
+
+    pos = i + 8;
+    return true;
+}
+
+/**
+ * @brief Декодировать найденные scanBlocks блоки (параллельно, если есть пул)
+ * Блоки независимы, каждый пишет в свой участок out. Текст блока с контрольной суммой
+ * сверяется сразу после декодирования, в той же задаче
+ * @param out Начало текста, смещения блоков отсчитываются от него
+ * @throw std::runtime_error Если блок поврежден или его текст не сошелся с контрольной суммой
+ */
+void Huffman::Decoder::decodeScanned(char* out)
+{
+    const auto task = [this, out](std::size_t b)
+    {
+        const auto& block = m_blocks[b];
+        decodeBlock(block.type, m_lengths[block.lengths], block.payload, block.count, out + block.offset);
+
+        // Текст блока только что записан и еще в кэше - сверяем его, пока не вытеснен
+        if (m_hasChecksums && checksum(std::string_view(out + block.offset, block.count)) != block.checksum)
+            throw std::runtime_error("Block checksum mismatch.");
+    };
+    measure(m_stats, &Stats::decodeNs, [&]
+    {
+        if (m_pool)
+            m_pool->parallelFor(m_blocks.size(), task);
+        else
+            for (std::size_t b = 0; b < m_blocks.size(); ++b)
+                task(b);
+    });
+}
+
+/**
+ * @brief Закодировать тело одного блока, заголовок блока дописывается при выводе
+ * @param block Блок текста
+ * @param plan Выбранный тип блока и коды
+ * @param body Строка, в которую записывается тело блока (старое содержимое стирается)
+ */
+void Huffman::encodeBlock(std::string_view block, Encoder::BlockPlan& plan, std::string& body)
+{
+    if (plan.type == RawBlock || plan.type == RunBlock)
+    {
+        body.clear();
+        body += static_cast<char>(plan.type);
+        body.append(block.data(), plan.type == RawBlock ? block.size() : 1);
+        return;
+    }
+
+    if (plan.type == ContextBlock)
+    {
+        emitContextBlock(block, plan.context, body);
+        return;
+    }
+
+    if (plan.type == WideBlock)
+    {
+        emitWideBlock(block, plan.wide, body);
+        return;
+    }
+
+    if (emitBlock(block, plan.histograms, plan.huffmanCode, plan.reuseTable, body))
+        return;
+
+    // Коды по выборке оказались не короче хранения как есть
+    plan.type = RawBlock;
+    encodeBlock(block, plan, body);
+}
+
+/**
+ * @brief Построить модель порядка 1 для блока
+ * Контекст символа - предыдущий байт (у первого символа - 0). Самые частые контексты
+ * становятся начальными группами, затем дважды каждый контекст относится к группе,
+ * на которой он кодируется короче всего, и группы пересчитываются. Длина кода при
+ * выборе группы оценивается по частотам группы со сглаживанием, чтобы учесть и символы,
+ * которых в группе пока нет
+ * @param block Блок текста
+ * @param maxCodeLength Наибольшая длина кода
+ * @param model Модель блока
+ */
+void Huffman::planContext(std::string_view block, unsigned maxCodeLength, ContextModel& model)
+{
+    // Частоты по контекстам свои у каждого потока, после блока обнуляются только встретившиеся строки
+    thread_local std::vector<Histogram> counts(256, Histogram{});
+
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+    Histogram totals{};
+    unsigned previous = 0;
+    for (std::size_t n = 0; n < block.size(); ++n)
+    {
+        ++counts[previous][bytes[n]];
+        ++totals[previous];
+        previous = bytes[n];
+    }
+
+    std::array<std::uint8_t, 256> contexts;
+    std::size_t present = 0;
+    for (unsigned c = 0; c < 256; ++c)
+        if (totals[c])
+            contexts[present++] = static_cast<std::uint8_t>(c);
+
+    std::sort(contexts.begin(), contexts.begin() + present, [&totals](std::uint8_t lhs, std::uint8_t rhs)
+    {
+        return totals[lhs] == totals[rhs] ? lhs < rhs : totals[lhs] > totals[rhs];
+    });
+
+    const auto groups = std::max<std::size_t>(1, std::min({ kMaxContextTables, present, block.size() / kContextTableBytes }));
+
+    std::array<Histogram, kMaxContextTables> clusters;
+    for (std::size_t k = 0; k < groups; ++k)
+        clusters[k] = counts[contexts[k]];
+
+    model.map.fill(0);
+    for (unsigned pass = 0; pass < 2 && groups > 1; ++pass)
+    {
+        // Цена символа в группе - минус логарифм его сглаженной вероятности
+        std::array<std::array<float, 256>, kMaxContextTables> cost;
+        for (std::size_t k = 0; k < groups; ++k)
+        {
+            std::uint64_t total = 0;
+            for (const auto count : clusters[k])
+                total += count;
+
+            for (unsigned s = 0; s < 256; ++s)
+                cost[k][s] = -std::log2((static_cast<float>(clusters[k][s]) + 0.5f) / (static_cast<float>(total) + 128.0f));
+        }
+
+        for (std::size_t c = 0; c < present; ++c)
+        {
+            const auto& row = counts[contexts[c]];
+
+            float best = 0;
+            for (std::size_t k = 0; k < groups; ++k)
+            {
+                float bits = 0;
+                for (unsigned s = 0; s < 256; ++s)
+                    bits += static_cast<float>(row[s]) * cost[k][s];
+
+                if (k == 0 || bits < best)
+                {
+                    best = bits;
+                    model.map[contexts[c]] = static_cast<std::uint8_t>(k);
+                }
+            }
+        }
+
+        for (std::size_t k = 0; k < groups; ++k)
+            clusters[k].fill(0);
+
+        for (std::size_t c = 0; c < present; ++c)
+            for (unsigned s = 0; s < 256; ++s)
+                clusters[model.map[contexts[c]]][s] += counts[contexts[c]][s];
+    }
+
+    if (groups == 1)
+    {
+        clusters[0].fill(0);
+        for (std::size_t c = 0; c < present; ++c)
+            for (unsigned s = 0; s < 256; ++s)
+                clusters[0][s] += counts[contexts[c]][s];
+    }
+
+    // Пустые группы выбрасываем, номера остальных сдвигаем
+    std::array<std::uint8_t, kMaxContextTables> renumber;
+    model.tables = 0;
+    for (std::size_t k = 0; k < groups; ++k)
+    {
+        renumber[k] = static_cast<std::uint8_t>(model.tables);
+        if (std::any_of(clusters[k].begin(), clusters[k].end(), [](std::uint64_t count) { return count != 0; }))
+            clusters[model.tables++] = clusters[k];
+    }
+
+    for (auto& table : model.map)
+        table = renumber[table];
+
+    // Заголовок: тип, число таблиц, карта контекстов по 4 бита и длины кодов таблиц
+    std::uint64_t headerBytes = 2 + 128;
+    model.payloadBits = 0;
+    for (std::size_t k = 0; k < model.tables; ++k)
+    {
+        model.codes[k] = generateHuffmanCodes(generateHuffmanTree(clusters[k]), maxCodeLength);
+        model.payloadBits += codedBits(clusters[k], model.codes[k]);
+        headerBytes += codeLengthsSize(model.codes[k]);
+    }
+
+    model.bits = model.payloadBits + 8 * headerBytes;
+
+    for (std::size_t c = 0; c < present; ++c)
+        counts[contexts[c]].fill(0);
+}
+
+/**
+ * @brief Записать тело блока с моделью порядка 1: тип, число таблиц, карта контекстов
+ * по 4 бита, длины кодов таблиц и один битовый поток
+ * @param block Блок текста
+ * @param model Модель блока
+ * @param body Строка, в которую записывается тело блока (старое содержимое стирается)
+ */
+void Huffman::emitContextBlock(std::string_view block, const ContextModel& model, std::string& body)
+{
+    body.clear();
+    body += static_cast<char>(ContextBlock);
+    body += static_cast<char>(model.tables);
+    for (unsigned c = 0; c < 256; c += 2)
+        body += static_cast<char>(model.map[c] << 4 | model.map[c + 1]);
+
+    for (std::size_t k = 0; k < model.tables; ++k)
+        writeCodeLengths(body, model.codes[k]);
+
+    const auto header = body.size();
+    body.resize(header + static_cast<std::size_t>((model.payloadBits + 7) / 8));
+
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+    BitWriter writer(&body[0] + header);
+    unsigned previous = 0;
+    for (std::size_t n = 0; n < block.size(); ++n)
+    {
+        const auto code = model.codes[model.map[previous]][bytes[n]];
+        writer.write(code.bits, code.length);
+        previous = bytes[n];
+    }
+
+    writer.flush();
+}
+
+/**
+ * @brief Построить коды блока по парам байтов
+ * Символ - пара соседних байтов, нечетный последний байт хранится как есть.
+ * Ограничение длины кода поднимается до числа бит, которого хватает на все встретившиеся символы
+ * @param block Блок текста
+ * @param maxCodeLength Наибольшая длина кода
+ * @param model Коды блока, память переиспользуется от блока к блоку
+ */
+void Huffman::planWide(std::string_view block, unsigned maxCodeLength, WideModel& model)
+{
+    // Счетчики и длины свои у каждого потока, после блока обнуляются только встретившиеся символы
+    thread_local std::vector<std::uint32_t> counts(kWideAlphabetSize, 0);
+    thread_local std::vector<unsigned char> lengths(kWideAlphabetSize, 0);
+    thread_local std::vector<WideCodeWord> words;
+
+    // Коды прошлого блока стираем по его же списку символов, а не всю таблицу
+    if (model.codes.size() != kWideAlphabetSize)
+        model.codes.assign(kWideAlphabetSize, Code{ 0, 0 });
+
+    for (const auto s : model.symbols)
+        model.codes[s] = Code{ 0, 0 };
+
+    model.symbols.clear();
+    model.payloadBits = 0;
+    model.bits = ~std::uint64_t(0);
+
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+    const auto pairs = block.size() / 2;
+    if (pairs == 0)
+        return;
+
+    for (std::size_t n = 0; n < pairs; ++n)
+    {
+        const auto s = static_cast<WideSymbol>(bytes[2 * n] | bytes[2 * n + 1] << 8);
+        if (counts[s]++ == 0)
+            model.symbols.push_back(s);
+    }
+
+    std::sort(model.symbols.begin(), model.symbols.end());
+
+    unsigned needed = 1;
+    while ((std::size_t(1) << needed) < model.symbols.size())
+        ++needed;
+
+    generateWideCodeLengths(counts, model.symbols, std::max(maxCodeLength, needed), lengths);
+    generateCanonicalCodes(lengths, words);
+
+    // Заголовок: тип, число символов, пары (разность с предыдущим символом, длина) и нечетный байт
+    const auto varintSize = [](std::uint64_t value)
+    {
+        std::uint64_t size = 1;
+        for (; value >= 0x80; value >>= 7)
+            ++size;
+
+        return size;
+    };
+
+    std::uint64_t headerBytes = 1 + varintSize(model.symbols.size()) + block.size() % 2;
+    std::uint32_t next = 0;
+    for (const auto s : model.symbols)
+    {
+        headerBytes += varintSize(s - next) + 1;
+        next = s + 1u;
+    }
+
+    for (const auto& word : words)
+    {
+        model.codes[word.symbol] = Code{ static_cast<std::uint32_t>(word.bits), static_cast<std::uint8_t>(word.length) };
+        model.payloadBits += std::uint64_t(counts[word.symbol]) * word.length;
+    }
+
+    model.bits = model.payloadBits + 8 * headerBytes;
+
+    for (const auto s : model.symbols)
+    {
+        counts[s] = 0;
+        lengths[s] = 0;
+    }
+}
+
+/**
+ * @brief Записать тело блока с кодами пар байтов: тип, число символов, пары
+ * (разность с предыдущим символом, длина кода), нечетный последний байт и один битовый поток
+ * @param block Блок текста
+ * @param model Коды блока
+ * @param body Строка, в которую записывается тело блока (старое содержимое стирается)
+ */
+void Huffman::emitWideBlock(std::string_view block, const WideModel& model, std::string& body)
+{
+    body.clear();
+    body += static_cast<char>(WideBlock);
+    putVarint(body, model.symbols.size());
+
+    std::uint32_t next = 0;
+    for (const auto s : model.symbols)
+    {
+        putVarint(body, s - next);
+        body += static_cast<char>(model.codes[s].length);
+        next = s + 1u;
+    }
+
+    if (block.size() % 2)
+        body += block.back();
+
+    const auto header = body.size();
+    body.resize(header + static_cast<std::size_t>((model.payloadBits + 7) / 8));
+
+    // Один код на два байта текста: вдвое меньше итераций, чем у кодов байтов
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+    BitWriter writer(&body[0] + header);
+    for (std::size_t n = 0; n < block.size() / 2; ++n)
+    {
+        const auto code = model.codes[bytes[2 * n] | bytes[2 * n + 1] << 8];
+        writer.write(code.bits, code.length);
+    }
+
+    writer.flush();
+}
+
+/**
+ * @brief Посчитать гистограммы блока
+ * Большие блоки делятся на четыре четверти, каждая кодируется в свой битовый поток,
+ * поэтому и частоты считаются по четвертям: по ним потом точно известен размер каждого потока.
+ * С Settings::sampled частоты большого блока только оцениваются по выборке
+ * @param block Блок текста
+ * @param settings Параметры кодирования
+ * @return Huffman::BlockHistograms Гистограммы блока
+ */
+Huffman::BlockHistograms Huffman::countBlock(std::string_view block, const Settings& settings)
+{
+    BlockHistograms histograms;
+    histograms.streams = settings.interleaved && block.size() >= kMinInterleavedBlockSize ? 4 : 1;
+
+    // По выборке размеры потоков не узнать, их узнает emitBlock, записав потоки
+    histograms.sampled = settings.sampled && block.size() >= kMinSampledBlockSize;
+    if (histograms.sampled)
+    {
+        histograms.total = sampleHistogram(block);
+        return histograms;
+    }
+
+    histograms.total.fill(0);
+
+    const auto quarter = (block.size() + histograms.streams - 1) / histograms.streams;
+    for (std::size_t k = 0; k < histograms.streams; ++k)
+    {
+        const auto stream = block.substr(std::min(k * quarter, block.size()), quarter);
+        histograms.stream[k] = buildHistogram(stream.data(), stream.size());
+
+        for (unsigned s = 0; s < 256; ++s)
+            histograms.total[s] += histograms.stream[k][s];
+    }
+
+    return histograms;
+}
+
+/**
+ * @brief Выгодно ли закодировать блок кодами предыдущего блока
+ * Размер блока со своими кодами оценивается снизу: энтропия по гистограмме плюс
+ * самый короткий возможный заголовок. Если коды предыдущего блока не длиннее этой оценки,
+ * они заведомо не хуже своих, и дерево можно не строить
+ * @param histogram Гистограмма блока
+ * @param previous Коды предыдущего блока
+ * @return bool true, если блок стоит закодировать кодами previous
+ */
+bool Huffman::canReuseTable(const Histogram& histogram, const CodeTable& previous)
+{
+    const auto reuseBits = codedBits(histogram, previous);
+
+    return reuseBits != UINT64_MAX && static_cast<double>(reuseBits) <= lowerBoundBits(histogram);
+}
+
+/**
+ * @brief Оценка снизу размера блока со своими кодами
+ * Никакие коды не короче энтропии гистограммы, а заголовок не короче самого короткого
+ * из форматов LengthsFormat
+ * @param histogram Гистограмма блока
+ * @return double Оценка в битах
+ */
+double Huffman::lowerBoundBits(const Histogram& histogram)
+{
+    std::uint64_t total = 0;
+    std::size_t present = 0;
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        total += histogram[s];
+        present += histogram[s] != 0;
+    }
+
+    double entropyBits = 0;
+    for (unsigned s = 0; s < 256; ++s)
+        if (histogram[s])
+            entropyBits -= static_cast<double>(histogram[s]) * std::log2(static_cast<double>(histogram[s]) / static_cast<double>(total));
+
+    // Способ записи длин и самый короткий из форматов LengthsFormat
+    const std::size_t headerBytes = 1 + std::min<std::size_t>(1 + 2 * present, 128);
+
+    return entropyBits + 8.0 * static_cast<double>(headerBytes);
+}
+
+/**
+ * @brief Короче ли блок с кодами предыдущего блока, чем со своими кодами и их заголовком
+ * @param histogram Гистограмма блока
+ * @param previous Коды предыдущего блока
+ * @param huffmanCode Свои коды блока
+ * @return bool true, если блок стоит закодировать кодами previous
+ */
+bool Huffman::preferReusedTable(const Histogram& histogram, const CodeTable& previous, const CodeTable& huffmanCode)
+{
+    const auto reuseBits = codedBits(histogram, previous);
+    if (reuseBits == UINT64_MAX)
+        return false;
+
+    return reuseBits <= codedBits(histogram, huffmanCode) + 8 * codeLengthsSize(huffmanCode);
+}
+
+/**
+ * @brief Сколько бит займет текст с данной гистограммой в данных кодах
+ * @param histogram Гистограмма текста
+ * @param huffmanCode Коды символов
+ * @return std::uint64_t Количество бит, UINT64_MAX - у какого-то символа текста нет кода
+ */
+std::uint64_t Huffman::codedBits(const Histogram& histogram, const CodeTable& huffmanCode)
+{
+    std::uint64_t bits = 0;
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        if (histogram[s] && !huffmanCode[s].length)
+            return UINT64_MAX;
+
+        bits += histogram[s] * huffmanCode[s].length;
+    }
+
+    return bits;
+}
+
+/**
+ * @brief Записать тело блока: тип, длины канонических кодов (если они свои) и закодированный текст
+ * Четыре четверти блока кодируются в независимые битовые потоки, чтобы декодер мог
+ * разбирать их одновременно: цепочки зависимостей потоков не пересекаются.
+ * Размер каждого потока заранее известен по гистограммам, поэтому тело выделяется один раз
+ * и коды пишутся в него без проверок места.
+ * У блока по выборке размеры потоков неизвестны: потоки пишутся в рабочий буфер с запасом
+ * по самому длинному коду и потом переносятся в тело вплотную
+ * @param block Блок текста
+ * @param histograms Гистограммы блока
+ * @param huffmanCode Коды символов
+ * @param reuseTable Коды взяты у предыдущего блока, вместо длин кодов ставится флаг kReuseTableFlag
+ * @param body Строка, в которую записывается тело блока (старое содержимое стирается)
+ * @return bool true - тело записано, false - коды по выборке вышли не короче хранения как есть
+ */
+bool Huffman::emitBlock(std::string_view block, const BlockHistograms& histograms, const CodeTable& huffmanCode, bool reuseTable, std::string& body)
+{
+    const unsigned char type = histograms.streams == 4 ? FourStreamBlock : SingleStreamBlock;
+
+    body.clear();
+    body += static_cast<char>(reuseTable ? type | kReuseTableFlag : type);
+    if (!reuseTable)
+        writeCodeLengths(body, huffmanCode);
+
+    if (histograms.sampled)
+        return emitSampledStreams(block, histograms.streams, huffmanCode, body);
+
+    std::size_t sizes[4];
+    std::size_t total = 0;
+    for (std::size_t k = 0; k < histograms.streams; ++k)
+    {
+        sizes[k] = streamSize(histograms.stream[k], huffmanCode);
+        total += sizes[k];
+    }
+
+    // Таблица переходов: размеры первых трех потоков, четвертый идет до конца блока
+    if (histograms.streams == 4)
+        for (std::size_t k = 0; k < 3; ++k)
+            putVarint(body, sizes[k]);
+
+    const auto header = body.size();
+    body.resize(header + total);
+
+    char* out[4];
+    out[0] = &body[0] + header;
+    for (std::size_t k = 1; k < histograms.streams; ++k)
+        out[k] = out[k - 1] + sizes[k - 1];
+
+    kernels().emit(block, huffmanCode, histograms.streams, out);
+
+    return true;
+}
+
+/**
+ * @brief Записать битовые потоки блока по выборке вслед за заголовком тела
+ * @param block Блок текста
+ * @param streams Количество потоков, 1 или 4
+ * @param huffmanCode Коды символов, код есть у каждого байта
+ * @param body Тело блока с уже записанными типом и длинами кодов
+ * @return bool true - потоки записаны, false - тело вышло бы не короче хранения как есть
+ */
+bool Huffman::emitSampledStreams(std::string_view block, std::size_t streams, const CodeTable& huffmanCode, std::string& body)
+{
+    unsigned longest = 0;
+    for (const auto& code : huffmanCode)
+        longest = std::max<unsigned>(longest, code.length);
+
+    // Буфер только растет: resize при уменьшении и новом росте не заполнял бы его заново
+    thread_local std::string scratch;
+    const auto quarter = (block.size() + streams - 1) / streams;
+    const auto room = (quarter * longest + 7) / 8;
+    if (scratch.size() < room * streams)
+        scratch.resize(room * streams);
+
+    char* starts[4];
+    char* out[4];
+    for (std::size_t k = 0; k < streams; ++k)
+        starts[k] = out[k] = &scratch[0] + k * room;
+
+    kernels().emit(block, huffmanCode, streams, out);
+
+    std::size_t total = 0;
+    for (std::size_t k = 0; k < streams; ++k)
+        total += static_cast<std::size_t>(out[k] - starts[k]);
+
+    if (streams == 4)
+        for (std::size_t k = 0; k < 3; ++k)
+            putVarint(body, static_cast<std::size_t>(out[k] - starts[k]));
+
+    if (body.size() + total > block.size())
+        return false;
+
+    for (std::size_t k = 0; k < streams; ++k)
+        body.append(starts[k], static_cast<std::size_t>(out[k] - starts[k]));
+
+    return true;
+}
+
+/**
+ * @brief Записать текст одним битовым потоком, упакованным по 8 бит в байт
+ * Длина текста записывается перед блоком, поэтому добивка нулями в последнем байте не мешает
+ * @param text Текст
+ * @param huffmanCode Коды символов
+ * @param out Место под поток размером streamSize байт
+ * @return char* Конец записанного потока
+ */
+char* Huffman::emitStream(std::string_view text, const CodeTable& huffmanCode, char* out)
+{
+    return kernels().emit(text, huffmanCode, 1, &out);
+}
+
+/**
+ * @brief Записать блок в один или четыре битовых потока, четвертый поток может быть короче
+ * Четыре потока пишутся вперемешку, по символу в каждый за итерацию: у каждого свой
+ * аккумулятор, и цепочки зависимостей разных потоков не ждут друг друга
+ * @param block Блок текста
+ * @param huffmanCode Коды символов
+ * @param streams Количество потоков, 1 или 4
+ * @param out Начала потоков, каждому отведено не меньше streamSize байт; сюда же пишутся их концы
+ * @return char* Конец последнего потока
+ */
+HUFFMAN_ALWAYS_INLINE char* Huffman::emitStreams(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out)
+{
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+
+    if (streams == 1)
+    {
+        BitWriter writer(out[0]);
+        for (std::size_t n = 0; n < block.size(); ++n)
+        {
+            const auto code = huffmanCode[bytes[n]];
+            writer.write(code.bits, code.length);
+        }
+
+        return out[0] = writer.flush();
+    }
+
+    const auto quarter = (block.size() + 3) / 4;
+    const unsigned char* src[4];
+    std::size_t lengths[4];
+    for (std::size_t k = 0; k < 4; ++k)
+    {
+        const auto first = std::min(k * quarter, block.size());
+        src[k] = bytes + first;
+        lengths[k] = std::min(first + quarter, block.size()) - first;
+    }
+
+    BitWriter writers[4] = { BitWriter(out[0]), BitWriter(out[1]), BitWriter(out[2]), BitWriter(out[3]) };
+
+    const auto common = lengths[3];
+    for (std::size_t n = 0; n < common; ++n)
+    {
+        const auto code0 = huffmanCode[src[0][n]];
+        const auto code1 = huffmanCode[src[1][n]];
+        const auto code2 = huffmanCode[src[2][n]];
+        const auto code3 = huffmanCode[src[3][n]];
+        writers[0].write(code0.bits, code0.length);
+        writers[1].write(code1.bits, code1.length);
+        writers[2].write(code2.bits, code2.length);
+        writers[3].write(code3.bits, code3.length);
+    }
+
+    for (std::size_t k = 0; k < 3; ++k)
+    {
+        for (std::size_t n = common; n < lengths[k]; ++n)
+        {
+            const auto code = huffmanCode[src[k][n]];
+            writers[k].write(code.bits, code.length);
+        }
+
+        out[k] = writers[k].flush();
+    }
+
+    return out[3] = writers[3].flush();
+}
+
+/**
+ * @brief Разобрать один или четыре битовых потока блока
+ * Из четырех потоков символы читаются по очереди, по одному из каждого за итерацию
+ * @param readers Потоки блока
+ * @param streams Количество потоков, 1 или 4
+ * @param table Таблица декодирования
+ * @param count Длина декодированного текста
+ * @param out Место под декодированный текст, не меньше count байт
+ */
+HUFFMAN_ALWAYS_INLINE void Huffman::decodeStreams(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out)
+{
+    if (streams == 1)
+    {
+        for (std::size_t n = 0; n < count; ++n)
+            out[n] = decodeSymbol<char>(readers[0], table);
+
+        return;
+    }
+
+    const auto quarter = (count + 3) / 4;
+    char* dst[4];
+    std::size_t lengths[4];
+    for (std::size_t k = 0; k < 4; ++k)
+    {
+        const auto first = std::min(k * quarter, count);
+        dst[k] = out + first;
+        lengths[k] = std::min(first + quarter, count) - first;
+    }
+
+    // Первые три потока длиной quarter, последний может быть короче.
+    // Пока символы есть во всех четырех - разбираем по символу из каждого за итерацию
+    const auto common = lengths[3];
+    for (std::size_t n = 0; n < common; ++n)
+    {
+        dst[0][n] = decodeSymbol<char>(readers[0], table);
+        dst[1][n] = decodeSymbol<char>(readers[1], table);
+        dst[2][n] = decodeSymbol<char>(readers[2], table);
+        dst[3][n] = decodeSymbol<char>(readers[3], table);
+    }
+
+    for (std::size_t k = 0; k < 3; ++k)
+        for (std::size_t n = common; n < lengths[k]; ++n)
+            dst[k][n] = decodeSymbol<char>(readers[k], table);
+}
+
+const Huffman::Kernels Huffman::kGenericKernels = { "generic", &Huffman::emitStreamsGeneric, &Huffman::decodeStreamsGeneric, &Huffman::checksumGeneric };
+
+char* Huffman::emitStreamsGeneric(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out)
+{
+    return emitStreams(block, huffmanCode, streams, out);
+}
+
+void Huffman::decodeStreamsGeneric(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out)
+{
+    decodeStreams(readers, streams, table, count, out);
+}
+
+/**
+ * @brief Построить таблицы CRC32C (отраженный полином 0x82F63B78)
+ * tables[0] - остаток для одного байта, tables[k] - для байта, за которым идут еще k байт
+ * @return Huffman::ChecksumTables Таблицы
+ */
+constexpr Huffman::ChecksumTables Huffman::makeChecksumTables()
+{
+    ChecksumTables tables{};
+    for (std::uint32_t n = 0; n < 256; ++n)
+    {
+        auto crc = n;
+        for (unsigned bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0u);
+
+        tables[0][n] = crc;
+    }
+
+    for (unsigned k = 1; k < 8; ++k)
+        for (unsigned n = 0; n < 256; ++n)
+            tables[k][n] = (tables[k - 1][n] >> 8) ^ tables[0][tables[k - 1][n] & 0xFF];
+
+    return tables;
+}
+
+// CRC32C по таблицам, 8 байт за шаг: восемь независимых обращений к таблицам вместо цепочки из восьми
+std::uint32_t Huffman::checksumGeneric(std::string_view text)
+{
+    static constexpr auto kTables = makeChecksumTables();
+
+    const auto bytes = reinterpret_cast<const unsigned char*>(text.data());
+    std::uint32_t crc = 0xFFFFFFFF;
+    std::size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8)
+    {
+        const auto low = crc ^ (std::uint32_t(bytes[i]) | std::uint32_t(bytes[i + 1]) << 8 | std::uint32_t(bytes[i + 2]) << 16 | std::uint32_t(bytes[i + 3]) << 24);
+        crc = kTables[7][low & 0xFF] ^ kTables[6][(low >> 8) & 0xFF] ^ kTables[5][(low >> 16) & 0xFF] ^ kTables[4][low >> 24]
+            ^ kTables[3][bytes[i + 4]] ^ kTables[2][bytes[i + 5]] ^ kTables[1][bytes[i + 6]] ^ kTables[0][bytes[i + 7]];
+    }
+
+    for (; i < text.size(); ++i)
+        crc = (crc >> 8) ^ kTables[0][(crc ^ bytes[i]) & 0xFF];
+
+    return ~crc;
+}
+
+#if HUFFMAN_BMI2_KERNELS
+const Huffman::Kernels Huffman::kBmi2Kernels = { "bmi2", &Huffman::emitStreamsBmi2, &Huffman::decodeStreamsBmi2, &Huffman::checksumBmi2 };
+
+// Те же циклы, но сдвиги на переменную величину - shlx/shrx, которые не трогают флаги
+HUFFMAN_TARGET_BMI2 char* Huffman::emitStreamsBmi2(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out)
+{
+    return emitStreams(block, huffmanCode, streams, out);
+}
+
+HUFFMAN_TARGET_BMI2 void Huffman::decodeStreamsBmi2(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out)
+{
+    decodeStreams(readers, streams, table, count, out);
+}
+
+/**
+ * @brief Построить таблицы сдвига CRC32C на kChecksumLane нулевых байтов
+ * Сдвиг - умножение на x^(8 * kChecksumLane) по модулю полинома, оно линейно,
+ * поэтому хватает таблицы на каждый байт остатка
+ * @return Huffman::ChecksumShift Таблицы
+ */
+constexpr Huffman::ChecksumShift Huffman::makeChecksumShift()
+{
+    // В отраженной записи x^0 - старший бит, умножение на x - сдвиг вправо
+    std::uint32_t power = 0x80000000u;
+    for (std::size_t n = 0; n < 8 * kChecksumLane; ++n)
+        power = (power >> 1) ^ ((power & 1) ? 0x82F63B78u : 0u);
+
+    ChecksumShift shift{};
+    for (unsigned k = 0; k < 4; ++k)
+    {
+        for (std::uint32_t n = 0; n < 256; ++n)
+        {
+            const auto value = n << (8 * k);
+            auto term = power;
+            std::uint32_t product = 0;
+            for (unsigned bit = 0; bit < 32; ++bit)
+            {
+                if (value & (0x80000000u >> bit))
+                    product ^= term;
+
+                term = (term >> 1) ^ ((term & 1) ? 0x82F63B78u : 0u);
+            }
+
+            shift[k][n] = product;
+        }
+    }
+
+    return shift;
+}
+
+// CRC32C инструкцией crc32 из SSE4.2. У инструкции задержка в три такта, поэтому текст
+// идет тремя независимыми дорожками, а их остатки сводятся сдвигом
+HUFFMAN_TARGET_BMI2 std::uint32_t Huffman::checksumBmi2(std::string_view text)
+{
+    const auto bytes = reinterpret_cast<const unsigned char*>(text.data());
+    std::uint32_t crc = 0xFFFFFFFF;
+    std::size_t i = 0;
+#if defined(__x86_64__)
+    static constexpr auto kShift = makeChecksumShift();
+    const auto shift = [](std::uint64_t value)
+    {
+        return std::uint64_t(kShift[0][value & 0xFF] ^ kShift[1][(value >> 8) & 0xFF] ^ kShift[2][(value >> 16) & 0xFF] ^ kShift[3][(value >> 24) & 0xFF]);
+    };
+
+    std::uint64_t wide = crc;
+    for (; i + 3 * kChecksumLane <= text.size(); i += 3 * kChecksumLane)
+    {
+        std::uint64_t lanes[3] = { wide, 0, 0 };
+        for (std::size_t j = i; j < i + kChecksumLane; j += 8)
+        {
+            std::uint64_t words[3];
+            std::memcpy(&words[0], bytes + j, 8);
+            std::memcpy(&words[1], bytes + j + kChecksumLane, 8);
+            std::memcpy(&words[2], bytes + j + 2 * kChecksumLane, 8);
+            lanes[0] = __builtin_ia32_crc32di(lanes[0], words[0]);
+            lanes[1] = __builtin_ia32_crc32di(lanes[1], words[1]);
+            lanes[2] = __builtin_ia32_crc32di(lanes[2], words[2]);
+        }
+
+        wide = shift(shift(lanes[0]) ^ lanes[1]) ^ lanes[2];
+    }
+
+    for (; i + 8 <= text.size(); i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        wide = __builtin_ia32_crc32di(wide, word);
+    }
+
+    crc = static_cast<std::uint32_t>(wide);
+#endif
+    for (; i + 4 <= text.size(); i += 4)
+    {
+        std::uint32_t word;
+        std::memcpy(&word, bytes + i, 4);
+        crc = __builtin_ia32_crc32si(crc, word);
+    }
+
+    for (; i < text.size(); ++i)
+        crc = __builtin_ia32_crc32qi(crc, bytes[i]);
+
+    return ~crc;
+}
+#endif
+
+/**
+ * @brief Выбранный набор ядер, при первом обращении - лучший для этого процессора
+ * @return std::atomic<const Kernels*>& Набор ядер
+ */
+std::atomic<const Huffman::Kernels*>& Huffman::activeKernels()
+{
+    static std::atomic<const Kernels*> active{ []
+    {
+#if HUFFMAN_BMI2_KERNELS
+        if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("sse4.2"))
+            return &kBmi2Kernels;
+#endif
+        return &kGenericKernels;
+    }() };
+
+    return active;
+}
+
+/**
+ * @brief Собрана ли библиотека с HUFFMAN_STATS, то есть заполняются ли Stats
+ * @return true Если собрана
+ */
+bool Huffman::statsEnabled()
+{
+    return kStatsEnabled;
+}
+
+/**
+ * @brief Задать счетчик выделений памяти для Stats::allocations
+ * Библиотека не подменяет operator new: выделения считает программа, если ей это нужно
+ * @param counter Функция, возвращающая число выделений с начала работы процесса, или nullptr
+ */
+void Huffman::setAllocationCounter(AllocationCounter counter)
+{
+    allocationCounter.store(counter, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Имя набора ядер, которым сейчас кодируются и декодируются блоки
+ * @return const char* "generic" или "bmi2"
+ */
+const char* Huffman::kernelName()
+{
+    return kernels().name;
+}
+
+/**
+ * @brief Выбрать набор ядер по имени, например чтобы сравнить их
+ * Поток байтов от набора ядер не зависит. Выбирать стоит, пока нет кодирования и декодирования
+ * в других потоках: они могут докончить блок прежним набором
+ * @param name "generic" - есть везде, "bmi2" - на x86 с BMI2 и SSE4.2
+ * @return bool Выбран ли набор: false, если его нет или его не поддерживает процессор
+ */
+bool Huffman::selectKernels(std::string_view name)
+{
+    if (name == kGenericKernels.name)
+    {
+        activeKernels() = &kGenericKernels;
+        return true;
+    }
+
+#if HUFFMAN_BMI2_KERNELS
+    if (name == kBmi2Kernels.name && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("sse4.2"))
+    {
+        activeKernels() = &kBmi2Kernels;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+/**
+ * @brief Точный размер битового потока по гистограмме его текста
+ * @param histogram Гистограмма текста
+ * @param huffmanCode Коды символов
+ * @return std::size_t Размер потока в байтах
+ */
+std::size_t Huffman::streamSize(const Histogram& histogram, const CodeTable& huffmanCode)
+{
+    std::uint64_t bits = 0;
+    for (unsigned s = 0; s < 256; ++s)
+        bits += histogram[s] * huffmanCode[s].length;
+
+    return static_cast<std::size_t>((bits + 7) / 8);
+}
+
+/**
+ * @brief Декодировать один блок
+ * @param type Тип блока без флага kReuseTableFlag
+ * @param codeLengths Длины кодов блока (свои или предыдущего блока)
+ * @param block Закодированный текст блока за длинами кодов
+ * @param count Длина декодированного текста
+ * @param out Место под декодированный текст, не меньше count байт
+ * @throw std::runtime_error Если блок поврежден
+ */
+void Huffman::decodeBlock(unsigned char type, const CodeLengths& codeLengths, std::string_view block, std::size_t count, char* out)
+{
+    // Размеры тел этих блоков проверены при разборе потока
+    if (type == RawBlock)
+    {
+        std::memcpy(out, block.data(), count);
+        return;
+    }
+
+    if (type == RunBlock)
+    {
+        std::memset(out, block[0], count);
+        return;
+    }
+
+    if (type == ContextBlock)
+    {
+        decodeContextBlock(block, count, out);
+        return;
+    }
+
+    if (type == WideBlock)
+    {
+        decodeWideBlock(block, count, out);
+        return;
+    }
+
+    if (type != SingleStreamBlock && type != FourStreamBlock)
+        throw std::runtime_error("Invalid encoded block.");
+
+    // Сами коды восстанавливаются по длинам, дерево не нужно.
+    // Коды и таблица свои у каждого потока и переиспользуются от блока к блоку
+    thread_local std::vector<CodeWord> huffmanCode;
+    thread_local DecodeTable table;
+
+    std::size_t i = 0;
+    generateCanonicalCodes(codeLengths, huffmanCode);
+
+    if (huffmanCode.empty())
+        throw std::runtime_error("Invalid encoded header.");
+
+    buildDecodeTable(huffmanCode, table);
+
+    if (type == SingleStreamBlock)
+    {
+        BitReader reader(block.data() + i, block.size() - i);
+        kernels().decode(&reader, 1, table, count, out);
+        return;
+    }
+
+    // Находим начала потоков по таблице переходов
+    std::size_t sizes[4];
+    for (std::size_t k = 0; k < 3; ++k)
+        sizes[k] = getVarint(block, i);
+
+    if (sizes[0] > block.size() - i || sizes[1] > block.size() - i - sizes[0] || sizes[2] > block.size() - i - sizes[0] - sizes[1])
+        throw std::runtime_error("Invalid encoded block.");
+
+    sizes[3] = block.size() - i - sizes[0] - sizes[1] - sizes[2];
+
+    BitReader readers[4] = {
+        BitReader(block.data() + i, sizes[0]),
+        BitReader(block.data() + i + sizes[0], sizes[1]),
+        BitReader(block.data() + i + sizes[0] + sizes[1], sizes[2]),
+        BitReader(block.data() + i + sizes[0] + sizes[1] + sizes[2], sizes[3])
+    };
+
+    kernels().decode(readers, 4, table, count, out);
+}
+
+/**
+ * @brief Декодировать блок с моделью порядка 1
+ * Таблица для каждого символа выбирается по только что декодированному предыдущему
+ * @param block Тело блока за типом: число таблиц, карта контекстов, длины кодов и поток
+ * @param count Длина декодированного текста
+ * @param out Место под декодированный текст, не меньше count байт
+ * @throw std::runtime_error Если блок поврежден
+ */
+void Huffman::decodeContextBlock(std::string_view block, std::size_t count, char* out)
+{
+    if (block.size() < 1 + 128)
+        throw std::runtime_error("Invalid encoded block.");
+
+    const std::size_t tables = static_cast<unsigned char>(block[0]);
+    if (tables == 0 || tables > kMaxContextTables)
+        throw std::runtime_error("Invalid encoded block.");
+
+    // Таблицы и коды свои у каждого потока и переиспользуются от блока к блоку
+    thread_local std::vector<DecodeTable> decodeTables(kMaxContextTables);
+    thread_local std::vector<CodeWord> huffmanCode;
+
+    std::size_t i = 1 + 128;
+    for (std::size_t k = 0; k < tables; ++k)
+    {
+        generateCanonicalCodes(readCodeLengths(block, i), huffmanCode);
+        if (huffmanCode.empty())
+            throw std::runtime_error("Invalid encoded header.");
+
+        buildDecodeTable(huffmanCode, decodeTables[k], kContextLookupBits);
+    }
+
+    const DecodeTable* byContext[256];
+    for (unsigned c = 0; c < 256; ++c)
+    {
+        const std::size_t table = (static_cast<unsigned char>(block[1 + c / 2]) >> (c % 2 ? 0 : 4)) & 0xF;
+        if (table >= tables)
+            throw std::runtime_error("Invalid encoded block.");
+
+        byContext[c] = &decodeTables[table];
+    }
+
+    BitReader reader(block.data() + i, block.size() - i);
+    unsigned previous = 0;
+    for (std::size_t n = 0; n < count; ++n)
+    {
+        out[n] = decodeSymbol<char>(reader, *byContext[previous]);
+        previous = static_cast<unsigned char>(out[n]);
+    }
+}
+
+/**
+ * @brief Декодировать блок с кодами пар байтов
+ * @param block Тело блока за типом: число символов, пары (разность, длина), нечетный байт и поток
+ * @param count Длина декодированного текста
+ * @param out Место под декодированный текст, не меньше count байт
+ * @throw std::runtime_error Если блок поврежден
+ */
+void Huffman::decodeWideBlock(std::string_view block, std::size_t count, char* out)
+{
+    // Длины, коды и таблица свои у каждого потока и переиспользуются от блока к блоку
+    thread_local std::vector<unsigned char> lengths(kWideAlphabetSize, 0);
+    thread_local std::vector<WideCodeWord> huffmanCode;
+    thread_local DecodeTable table;
+
+    std::size_t i = 0;
+    const auto symbols = getVarint(block, i);
+    if (symbols == 0 || symbols > kWideAlphabetSize)
+        throw std::runtime_error("Invalid encoded header.");
+
+    std::fill(lengths.begin(), lengths.end(), 0);
+
+    std::uint64_t next = 0;
+    for (std::uint64_t k = 0; k < symbols; ++k)
+    {
+        const auto delta = getVarint(block, i);
+        if (delta >= kWideAlphabetSize - next || i >= block.size())
+            throw std::runtime_error("Invalid encoded header.");
+
+        next += delta;
+        const auto length = static_cast<unsigned char>(block[i++]);
+        if (length == 0 || length > kMaxCodeLengthLimit)
+            throw std::runtime_error("Invalid encoded header.");
+
+        lengths[next++] = length;
+    }
+
+    if (count % 2)
+    {
+        if (i >= block.size())
+            throw std::runtime_error("Invalid encoded block.");
+
+        out[count - 1] = block[i++];
+    }
+
+    generateCanonicalCodes(lengths, huffmanCode);
+    buildDecodeTable(huffmanCode, table);
+
+    BitReader reader(block.data() + i, block.size() - i);
+    for (std::size_t n = 0; n < count / 2; ++n)
+    {
+        const auto s = decodeSymbol<WideSymbol>(reader, table);
+        out[2 * n] = static_cast<char>(s & 0xFF);
+        out[2 * n + 1] = static_cast<char>(s >> 8);
+    }
+}
+
+/**
+ * @brief Прочитать из потока один символ
+ * Смотрим вперед на rootBits бит и сразу получаем символ и длину его кода.
+ * Длинные коды разрешаются переходом в подтаблицу по следующим битам
+ * @param reader Битовый поток
+ * @tparam SymbolT Тип символа: char для байтов, WideSymbol для пар байтов
+ * @param table Таблица декодирования
+ * @return SymbolT Символ
+ */
+template <typename SymbolT>
+inline SymbolT Huffman::decodeSymbol(BitReader& reader, const DecodeTable& table)
+{
+    const DecodeEntry* entry = &table.entries[reader.peek(table.rootBits)];
+    while (entry->subBits)
+    {
+        reader.skip(entry->length);
+        entry = &table.entries[entry->value + reader.peek(entry->subBits)];
+    }
+
+    reader.skip(entry->length);
+
+    return static_cast<SymbolT>(entry->value);
+}
+
+/**
+ * @brief Выгрузить оставшиеся биты, добив последний байт нулями
+ * @return char* Конец записанного потока
+ */
+char* Huffman::BitWriter::flush()
+{
+    const auto word = m_count ? static_cast<std::uint32_t>(m_acc << (32 - m_count)) : 0;
+    for (unsigned b = 0; b < (m_count + 7) / 8; ++b)
+        *m_out++ = static_cast<unsigned char>(word >> (24 - 8 * b));
+
+    m_acc = 0;
+    m_count = 0;
+
+    return reinterpret_cast<char*>(m_out);
+}
+
+/**
+ * @brief Дочитать байты в аккумулятор, чтобы в нем было не меньше 56 бит
+ * Пока до конца данных есть 8 байт, они читаются одним словом. Байт, который влез не целиком,
+ * следующая дозагрузка положит на то же место еще раз - те же биты, поэтому OR их не портит
+ */
+void Huffman::BitReader::refill()
+{
+    if (m_size - m_pos >= 8)
+    {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        std::uint64_t word;
+        std::memcpy(&word, m_data + m_pos, 8);
+        word = __builtin_bswap64(word);
+#else
+        std::uint64_t word = 0;
+        for (unsigned b = 0; b < 8; ++b)
+            word = word << 8 | m_data[m_pos + b];
+#endif
+
+        m_acc |= word >> m_count;
+        m_pos += (63 - m_count) >> 3;
+        m_count |= 56;
+        return;
+    }
+
+    while (m_count <= 56)
+    {
+        const std::uint64_t byte = m_pos < m_size ? m_data[m_pos++] : 0;
+        m_acc |= byte << (56 - m_count);
+        m_count += 8;
+    }
+}
+
+/**
+ * @brief Создать дерево Хаффмана
+ * @param freq Карта частот символов
+ * @return Huffman::Tree Дерево Хаффмана
+ */
+Huffman::Tree Huffman::generateHuffmanTree(const std::map<Symbol, std::size_t>& freq)
+{
+    Histogram histogram{};
+    for (const auto& f : freq)
+        histogram[f.first] = f.second;
+
+    return generateHuffmanTree(histogram);
+}
+
+/**
+ * @brief Создать дерево Хаффмана по гистограмме за линейное время
+ * Листья сортируются по частоте, новые ноды получаются в порядке неубывания частоты,
+ * поэтому вместо очереди с приоритетом хватает двух очередей: листьев и новых нод.
+ * Обе лежат в самом массиве нод: листья в начале, новые ноды дописываются за ними
+ * @param histogram Гистограмма байтов
+ * @return Huffman::Tree Дерево Хаффмана
+ */
+Huffman::Tree Huffman::generateHuffmanTree(const Histogram& histogram)
+{
+    Tree tree;
+
+    // Листья идут по возрастанию символа, устойчивая поразрядная сортировка по байтам частоты
+    // сохраняет этот порядок среди равных частот. Байтов у частот блока обычно не больше трех
+    std::array<Node, 256> buffers[2];
+    Node* leaves = buffers[0].data();
+    Node* sorted = buffers[1].data();
+
+    std::size_t count = 0;
+    std::uint64_t maxFreq = 0;
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        if (histogram[s])
+        {
+            leaves[count++] = Node{ static_cast<Symbol>(s), static_cast<std::size_t>(histogram[s]), kNoNode, kNoNode };
+            maxFreq = std::max(maxFreq, histogram[s]);
+        }
+    }
+
+    for (unsigned shift = 0; shift < 64 && (maxFreq >> shift); shift += 8)
+    {
+        std::size_t offsets[257] = {};
+        for (std::size_t k = 0; k < count; ++k)
+            ++offsets[((leaves[k].freq >> shift) & 0xFF) + 1];
+
+        for (unsigned d = 0; d < 256; ++d)
+            offsets[d + 1] += offsets[d];
+
+        for (std::size_t k = 0; k < count; ++k)
+            sorted[offsets[(leaves[k].freq >> shift) & 0xFF]++] = leaves[k];
+
+        std::swap(leaves, sorted);
+    }
+
+    if (count == 0)
+        return tree;
+
+    std::copy(leaves, leaves + count, tree.nodes.begin());
+    tree.size = static_cast<NodeIndex>(count);
+
+    // Берем две самые редкие ноды из голов очередей и создаем из них новую
+    // с частотой, равной сумме частот взятых. При равенстве берем лист - так короче самый длинный код
+    NodeIndex leaf = 0;
+    NodeIndex merged = tree.size;
+    const auto take = [&]() -> NodeIndex
+    {
+        if (leaf < count && (merged == tree.size || tree.nodes[leaf].freq <= tree.nodes[merged].freq))
+            return leaf++;
+
+        return merged++;
+    };
+
+    while (tree.size < 2 * count - 1)
+    {
+        const auto left = take();
+        const auto right = take();
+
+        tree.nodes[tree.size] = Node{ 0, tree.nodes[left].freq + tree.nodes[right].freq, left, right };
+        ++tree.size;
+    }
+
+    tree.root = static_cast<NodeIndex>(tree.size - 1);
+
+    return tree;
+}
+
+/**
+ * @brief Создать карту замен исходных символов на закодированные
+ * Из дерева берутся только длины кодов, сами коды назначаются канонически
+ * @param tree Дерево Хаффмана
+ * @param maxCodeLength Наибольшая длина кода, от kMinCodeLengthLimit до kMaxCodeLengthLimit
+ * @return Huffman::CodeTable Коды символов
+ */
+Huffman::CodeTable Huffman::generateHuffmanCodes(const Tree& tree, unsigned maxCodeLength)
+{
+    CodeLengths lengths{};
+    generateCodeLengths(tree, lengths);
+
+    if (*std::max_element(lengths.begin(), lengths.end()) > maxCodeLength)
+        limitCodeLengths(tree, maxCodeLength, lengths);
+
+    thread_local std::vector<CodeWord> codes;
+    generateCanonicalCodes(lengths, codes);
+
+    CodeTable huffmanCode{};
+    for (const auto& code : codes)
+        huffmanCode[code.symbol] = Code{ static_cast<std::uint32_t>(code.bits), static_cast<std::uint8_t>(code.length) };
+
+    return huffmanCode;
+}
+
+/**
+ * @brief Пересчитать длины кодов так, чтобы ни одна не превышала maxCodeLength
+ * Алгоритм package-merge: оптимальные длины при ограничении, за O(n * maxCodeLength).
+ * На каждом уровне соседние элементы списка склеиваются попарно в пакеты, пакеты
+ * сливаются с листьями по весу. Из списка последнего уровня берутся первые 2n - 2 элемента,
+ * длина кода символа - сколько раз его лист входит в них
+ * @param tree Дерево Хаффмана, из него берутся частоты листьев
+ * @param maxCodeLength Наибольшая длина кода, 2^maxCodeLength не меньше числа символов
+ * @param lengths Длины кодов символов
+ */
+void Huffman::limitCodeLengths(const Tree& tree, unsigned maxCodeLength, CodeLengths& lengths)
+{
+    // Элемент списка: лист (symbol >= 0) или пакет из двух элементов предыдущего уровня
+    struct Item
+    {
+        std::uint64_t weight;
+        int symbol;
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+
+    // Списки свои у каждого потока и переиспользуются от блока к блоку
+    thread_local std::vector<Item> items;
+    thread_local std::vector<std::uint32_t> leaves;
+    thread_local std::vector<std::uint32_t> current;
+    thread_local std::vector<std::uint32_t> packages;
+    thread_local std::vector<std::uint32_t> merged;
+    thread_local std::vector<std::uint32_t> stack;
+
+    items.clear();
+    leaves.clear();
+    for (NodeIndex n = 0; n < tree.size; ++n)
+    {
+        const auto& node = tree.nodes[n];
+        if (node.left == kNoNode && node.right == kNoNode)
+        {
+            leaves.push_back(static_cast<std::uint32_t>(items.size()));
+            items.push_back(Item{ node.freq, node.value, 0, 0 });
+        }
+    }
+
+    const auto lighter = [](std::uint32_t lhs, std::uint32_t rhs) { return items[lhs].weight < items[rhs].weight; };
+
+    // Равные веса - по порядку листьев, как при устойчивой сортировке, но без временного буфера
+    std::sort(leaves.begin(), leaves.end(), [](std::uint32_t lhs, std::uint32_t rhs)
+    {
+        return items[lhs].weight == items[rhs].weight ? lhs < rhs : items[lhs].weight < items[rhs].weight;
+    });
+
+    current = leaves;
+    for (unsigned level = 1; level < maxCodeLength; ++level)
+    {
+        packages.clear();
+        for (std::size_t k = 0; k + 1 < current.size(); k += 2)
+        {
+            packages.push_back(static_cast<std::uint32_t>(items.size()));
+            items.push_back(Item{ items[current[k]].weight + items[current[k + 1]].weight, -1, current[k], current[k + 1] });
+        }
+
+        merged.clear();
+        std::merge(leaves.begin(), leaves.end(), packages.begin(), packages.end(), std::back_inserter(merged), lighter);
+        current.swap(merged);
+    }
+
+    lengths.fill(0);
+
+    stack.assign(current.begin(), current.begin() + (2 * leaves.size() - 2));
+    while (!stack.empty())
+    {
+        const auto& item = items[stack.back()];
+        stack.pop_back();
+
+        if (item.symbol >= 0)
+        {
+            ++lengths[item.symbol];
+        }
+        else
+        {
+            stack.push_back(item.left);
+            stack.push_back(item.right);
+        }
+    }
+}
+
+/**
+ * @brief Посчитать длины кодов символов (глубины листьев дерева)
+ * Родитель лежит в массиве позже потомков, поэтому глубины находятся одним проходом
+ * от корня к началу массива, без рекурсии
+ * @param tree Дерево Хаффмана
+ * @param lengths Длины кодов символов
+ */
+void Huffman::generateCodeLengths(const Tree& tree, CodeLengths& lengths)
+{
+    std::array<unsigned char, 511> depths;
+    if (tree.root == kNoNode)
+        return;
+
+    depths[tree.root] = 0;
+    for (std::size_t node = tree.root + 1; node-- > 0;)
+    {
+        const auto& n = tree.nodes[node];
+        if (n.left == kNoNode && n.right == kNoNode)
+        {
+            // Единственному символу даем код длины 1, иначе его нельзя отличить от отсутствующего
+            lengths[n.value] = std::max<unsigned char>(depths[node], 1);
+            continue;
+        }
+
+        depths[n.left] = static_cast<unsigned char>(depths[node] + 1);
+        depths[n.right] = static_cast<unsigned char>(depths[node] + 1);
+    }
+}
+
+/**
+ * @brief Построить длины кодов для алфавита пар байтов
+ * Дерево строится двумя очередями по листьям, отсортированным по частоте, и хранится
+ * только ссылками на родителей. Если код вышел длиннее maxCodeLength, частоты
+ * сглаживаются вдвое и дерево строится заново: при равных частотах длины не больше
+ * log2 от числа символов, поэтому maxCodeLength не меньше его всегда достижим
+ * @param counts Частоты символов
+ * @param symbols Встретившиеся символы
+ * @param maxCodeLength Наибольшая длина кода
+ * @param lengths Длины кодов всего алфавита, заполняются только для symbols
+ */
+void Huffman::generateWideCodeLengths(const std::vector<std::uint32_t>& counts, const std::vector<WideSymbol>& symbols, unsigned maxCodeLength, std::vector<unsigned char>& lengths)
+{
+    const auto n = symbols.size();
+    if (n == 1)
+    {
+        // Единственному символу даем код длины 1, иначе его нельзя отличить от отсутствующего
+        lengths[symbols[0]] = 1;
+        return;
+    }
+
+    thread_local std::vector<WideSymbol> leaves;
+    thread_local std::vector<std::uint64_t> freq;
+    thread_local std::vector<std::uint32_t> parent;
+    thread_local std::vector<unsigned> depths;
+
+    leaves.assign(symbols.begin(), symbols.end());
+    std::sort(leaves.begin(), leaves.end(), [&counts](WideSymbol lhs, WideSymbol rhs)
+    {
+        return counts[lhs] == counts[rhs] ? lhs < rhs : counts[lhs] < counts[rhs];
+    });
+
+    // Листья занимают [0, n), внутренние ноды - [n, 2n - 1) в порядке появления, корень - последний
+    freq.resize(2 * n - 1);
+    parent.resize(2 * n - 1);
+    depths.resize(2 * n - 1);
+    for (std::size_t k = 0; k < n; ++k)
+        freq[k] = counts[leaves[k]];
+
+    while (true)
+    {
+        // Внутренние ноды появляются с неубывающими частотами, поэтому вторая очередь тоже упорядочена
+        std::size_t leaf = 0;
+        std::size_t node = n;
+        for (std::size_t next = n; next < 2 * n - 1; ++next)
+        {
+            freq[next] = 0;
+            for (int child = 0; child < 2; ++child)
+            {
+                const auto take = leaf < n && (node == next || freq[leaf] <= freq[node]) ? leaf++ : node++;
+                freq[next] += freq[take];
+                parent[take] = static_cast<std::uint32_t>(next);
+            }
+        }
+
+        // Родитель всегда правее потомков: глубины считаются одним проходом от корня
+        unsigned maxDepth = 0;
+        depths[2 * n - 2] = 0;
+        for (std::size_t k = 2 * n - 2; k-- > 0;)
+        {
+            depths[k] = depths[parent[k]] + 1;
+            maxDepth = std::max(maxDepth, depths[k]);
+        }
+
+        if (maxDepth <= maxCodeLength)
+            break;
+
+        // Сглаживание сохраняет порядок листьев, сортировать заново не нужно
+        for (std::size_t k = 0; k < n; ++k)
+            freq[k] = freq[k] >> 1 | 1;
+    }
+
+    for (std::size_t k = 0; k < n; ++k)
+        lengths[leaves[k]] = static_cast<unsigned char>(depths[k]);
+}
+
+/**
+ * @brief Назначить канонические коды по длинам
+ * Символы упорядочиваются по (длине, символу), каждый следующий код на единицу больше предыдущего,
+ * при переходе к большей длине код дополняется нулями справа.
+ * Длины из потока или словаря проверяются неравенством Крафта: код должен быть полным
+ * (сумма 2^-length ровно 1), иначе часть кодов совпадет или таблица декодирования
+ * останется с дырами. Исключение - единственный символ с кодом длины 1
+ * @tparam SymbolT Тип символа, lengths[s] - длина кода символа s
+ * @param lengths Длины кодов символов
+ * @param order Коды присутствующих символов в каноническом порядке (старое содержимое стирается)
+ * @throw std::runtime_error Если код длиннее kMaxCodeLengthLimit бит или длины не дают полного кода
+ */
+template <typename SymbolT, typename Lengths>
+void Huffman::generateCanonicalCodes(const Lengths& lengths, std::vector<BasicCodeWord<SymbolT>>& order)
+{
+    // Сумма Крафта в единицах 2^-kMaxCodeLengthLimit
+    std::uint64_t kraft = 0;
+
+    order.clear();
+    for (std::size_t s = 0; s < lengths.size(); ++s)
+    {
+        if (lengths[s] > kMaxCodeLengthLimit)
+            throw std::runtime_error("Invalid Huffman code length.");
+
+        if (lengths[s])
+        {
+            kraft += std::uint64_t(1) << (kMaxCodeLengthLimit - lengths[s]);
+            order.push_back(BasicCodeWord<SymbolT>{ static_cast<SymbolT>(s), 0, lengths[s] });
+        }
+    }
+
+    // Пустой набор разбирают вызывающие: кодировщику он нужен для пустых гистограмм
+    const bool single = order.size() == 1 && order.front().length == 1;
+    if (!order.empty() && !single && kraft != std::uint64_t(1) << kMaxCodeLengthLimit)
+        throw std::runtime_error("Invalid Huffman code lengths.");
+
+    std::sort(order.begin(), order.end(), [](const BasicCodeWord<SymbolT>& lhs, const BasicCodeWord<SymbolT>& rhs)
+    {
+        return lhs.length == rhs.length ? lhs.symbol < rhs.symbol : lhs.length < rhs.length;
+    });
+
+    std::uint64_t code = 0;
+    unsigned length = order.empty() ? 0 : order.front().length;
+    for (auto& c : order)
+    {
+        code <<= c.length - length;
+        length = c.length;
+
+        c.bits = code++;
+    }
+}
+
+/**
+ * @brief Записать длины кодов самым коротким из способов LengthsFormat
+ * @param out Строка, в которую дописывается заголовок
+ * @param huffmanCode Коды символов
+ */
+void Huffman::writeCodeLengths(std::string& out, const CodeTable& huffmanCode)
+{
+    unsigned char lengths[256];
+    unsigned maxLength = 0;
+    std::size_t present = 0;
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        lengths[s] = huffmanCode[s].length;
+        maxLength = std::max<unsigned>(maxLength, lengths[s]);
+        present += lengths[s] != 0;
+    }
+
+    const std::size_t sparseSize = 2 * present;
+    const std::size_t tableSize = maxLength <= 15 ? 128 : 256;
+
+    if (sparseSize < tableSize)
+    {
+        out += static_cast<char>(SparseLengths);
+        out += static_cast<char>(present);
+        for (unsigned s = 0; s < 256; ++s)
+        {
+            if (lengths[s])
+            {
+                out += static_cast<char>(s);
+                out += static_cast<char>(lengths[s]);
+            }
+        }
+    }
+    else if (tableSize == 128)
+    {
+        out += static_cast<char>(NibbleLengths);
+        for (unsigned s = 0; s < 256; s += 2)
+            out += static_cast<char>(lengths[s] << 4 | lengths[s + 1]);
+    }
+    else
+    {
+        out += static_cast<char>(ByteLengths);
+        out.append(reinterpret_cast<const char*>(lengths), 256);
+    }
+}
+
+/**
+ * @brief Размер длин кодов, которые запишет writeCodeLengths, без самой записи
+ * @param huffmanCode Коды символов
+ * @return std::size_t Размер в байтах
+ */
+std::size_t Huffman::codeLengthsSize(const CodeTable& huffmanCode)
+{
+    unsigned maxLength = 0;
+    std::size_t present = 0;
+    for (const auto& code : huffmanCode)
+    {
+        maxLength = std::max<unsigned>(maxLength, code.length);
+        present += code.length != 0;
+    }
+
+    const std::size_t sparseSize = 2 * present;
+    const std::size_t tableSize = maxLength <= 15 ? 128 : 256;
+
+    return 1 + (sparseSize < tableSize ? 1 + sparseSize : tableSize);
+}
+
+/**
+ * @brief Прочитать длины кодов, записанные writeCodeLengths
+ * @param text Закодированный текст
+ * @param i Позиция начала длин, после чтения - позиция за ними
+ * @return Huffman::CodeLengths Длины кодов символов
+ * @throw std::runtime_error Если заголовок поврежден
+ */
+Huffman::CodeLengths Huffman::readCodeLengths(std::string_view text, std::size_t& i)
+{
+    if (i >= text.size())
+        throw std::runtime_error("Invalid encoded header.");
+
+    const auto format = static_cast<unsigned char>(text[i++]);
+    const auto byte = [&](std::size_t n) { return static_cast<unsigned char>(text[i + n]); };
+
+    CodeLengths lengths{};
+    if (format == SparseLengths)
+    {
+        const std::size_t n = i < text.size() ? byte(0) : 0;
+        if (i + 1 + 2 * n > text.size())
+            throw std::runtime_error("Invalid encoded header.");
+
+        for (std::size_t s = 0; s < n; ++s)
+            lengths[byte(1 + 2 * s)] = byte(2 + 2 * s);
+
+        i += 1 + 2 * n;
+    }
+    else if (format == NibbleLengths || format == ByteLengths)
+    {
+        const std::size_t size = format == NibbleLengths ? 128 : 256;
+        if (i + size > text.size())
+            throw std::runtime_error("Invalid encoded header.");
+
+        for (unsigned s = 0; s < 256; ++s)
+        {
+            lengths[s] = format == NibbleLengths ? (byte(s / 2) >> (s % 2 ? 0 : 4)) & 0xF : byte(s);
+        }
+
+        i += size;
+    }
+    else
+    {
+        throw std::runtime_error("Invalid encoded header.");
+    }
+
+    return lengths;
+}
+
+/**
+ * @brief Контрольная сумма текста блока: CRC32C, посчитанная выбранным набором ядер
+ * @param text Текст
+ * @return std::uint32_t CRC32C текста
+ */
+std::uint32_t Huffman::checksum(std::string_view text)
+{
+    return kernels().checksum(text);
+}
+
+/**
+ * @brief Дописать контрольную сумму в конец тела блока (4 байта, little-endian)
+ * @param out Тело блока
+ * @param checksum Контрольная сумма
+ */
+void Huffman::putChecksum(std::string& out, std::uint32_t checksum)
+{
+    for (unsigned b = 0; b < 4; ++b)
+        out += static_cast<char>(checksum >> (8 * b));
+}
+
+/**
+ * @brief Отрезать контрольную сумму от конца тела блока
+ * @param body Тело блока, после вызова - без контрольной суммы
+ * @return std::uint32_t Контрольная сумма
+ * @throw std::runtime_error Если тело короче контрольной суммы
+ */
+std::uint32_t Huffman::takeChecksum(std::string_view& body)
+{
+    if (body.size() < 4)
+        throw std::runtime_error("Invalid encoded block.");
+
+    std::uint32_t checksum = 0;
+    for (unsigned b = 0; b < 4; ++b)
+        checksum |= std::uint32_t(static_cast<unsigned char>(body[body.size() - 4 + b])) << (8 * b);
+
+    body.remove_suffix(4);
+
+    return checksum;
+}
+
+/**
+ * @brief Записать число в формате varint (по 7 бит в байте, старший бит - признак продолжения)
+ * @param out Строка, в которую дописывается число
+ * @param value Число
+ */
+void Huffman::putVarint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+
+    out += static_cast<char>(value);
+}
+
+/**
+ * @brief Записать число в формате varint в буфер вызывающего
+ * @param out Буфер, в который дописывается число
+ * @param value Число
+ * @throw std::runtime_error Если в буфере нет места
+ */
+void Huffman::putVarint(OutputBuffer& out, std::uint64_t value)
+{
+    char bytes[10];
+    std::size_t size = 0;
+    for (; value >= 0x80; value >>= 7)
+        bytes[size++] = static_cast<char>(value | 0x80);
+
+    bytes[size++] = static_cast<char>(value);
+    out.append(bytes, size);
+}
+
+/**
+ * @brief Дописать данные в буфер вызывающего
+ * @param data Данные
+ * @param size Размер данных
+ * @throw std::runtime_error Если данные не помещаются; тогда ничего не пишется
+ */
+void Huffman::OutputBuffer::append(const char* data, std::size_t size)
+{
+    if (size > m_capacity - m_size)
+        throw std::runtime_error("Output buffer is too small.");
+
+    if (size)
+        std::memcpy(m_data + m_size, data, size);
+
+    m_size += size;
+}
+
+/**
+ * @brief Прочитать число, записанное putVarint
+ * @param text Закодированный текст
+ * @param i Позиция начала числа, после чтения - позиция за ним
+ * @return std::uint64_t Число
+ * @throw std::runtime_error Если число обрывается или не помещается в 64 бита
+ */
+std::uint64_t Huffman::getVarint(std::string_view text, std::size_t& i)
+{
+    std::uint64_t value;
+    if (!tryGetVarint(text, i, value))
+        throw std::runtime_error("Invalid encoded number.");
+
+    return value;
+}
+
+/**
+ * @brief Прочитать число, записанное putVarint, если оно уже пришло целиком
+ * @param text Закодированный текст
+ * @param i Позиция начала числа, после чтения - позиция за ним. Если число оборвано - не меняется
+ * @param value Прочитанное число
+ * @return true Если число прочитано
+ * @throw std::runtime_error Если число не помещается в 64 бита
+ */
+bool Huffman::tryGetVarint(std::string_view text, std::size_t& i, std::uint64_t& value)
+{
+    value = 0;
+    for (std::size_t pos = i, shift = 0; pos < text.size(); shift += 7)
+    {
+        if (shift >= 64)
+            throw std::runtime_error("Invalid encoded number.");
+
+        const auto byte = static_cast<unsigned char>(text[pos++]);
+        value |= std::uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            i = pos;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Построить таблицу декодирования по кодам
+ * @tparam SymbolT Тип символа, в элементах таблицы он хранится в DecodeEntry::value
+ * @param codes Коды присутствующих символов
+ * @param table Таблица декодирования (старое содержимое стирается, память переиспользуется)
+ * @param lookupBits Сколько бит смотрит корневая таблица
+ */
+template <typename SymbolT>
+void Huffman::buildDecodeTable(const std::vector<BasicCodeWord<SymbolT>>& codes, DecodeTable& table, unsigned lookupBits)
+{
+    unsigned maxLength = 0;
+    for (const auto& code : codes)
+        maxLength = std::max(maxLength, code.length);
+
+    table.rootBits = std::max(1u, std::min(lookupBits, maxLength));
+    table.entries.assign(std::size_t(1) << table.rootBits, DecodeEntry{ 0, 0, 0 });
+    buildDecodeLevel(table, 0, table.rootBits, 0, codes);
+}
+
+/**
+ * @brief Заполнить одну таблицу (корневую или подтаблицу) декодирования
+ * @param table Таблица декодирования, в которую дописываются подтаблицы
+ * @param base Начало заполняемой таблицы в table.entries
+ * @param bits Сколько бит индексирует заполняемая таблица
+ * @param shift Сколько старших бит кодов уже съедено верхними уровнями
+ * @param codes Коды, начинающиеся с префикса этой таблицы
+ */
+template <typename SymbolT>
+void Huffman::buildDecodeLevel(DecodeTable& table, std::size_t base, unsigned bits, unsigned shift, const std::vector<BasicCodeWord<SymbolT>>& codes)
+{
+    // Коды, которые не влезают в эту таблицу, группируем по индексу в ней
+    std::map<std::uint64_t, std::vector<BasicCodeWord<SymbolT>>> longCodes;
+
+    for (const auto& code : codes)
+    {
+        const unsigned rest = code.length - shift;
+        const std::uint64_t suffix = rest < 64 ? code.bits & ((std::uint64_t(1) << rest) - 1) : code.bits;
+
+        if (rest > bits)
+        {
+            longCodes[suffix >> (rest - bits)].push_back(code);
+            continue;
+        }
+
+        // Код короче таблицы занимает все элементы, у которых он является префиксом
+        const std::size_t first = base + (std::size_t(suffix) << (bits - rest));
+        const std::size_t last = first + (std::size_t(1) << (bits - rest));
+        for (std::size_t e = first; e < last; ++e)
+            table.entries[e] = DecodeEntry{ code.symbol, static_cast<std::uint8_t>(rest), 0 };
+    }
+
+    for (const auto& group : longCodes)
+    {
+        unsigned maxRest = 0;
+        for (const auto& code : group.second)
+            maxRest = std::max(maxRest, code.length - shift - bits);
+
+        const unsigned subBits = std::min(kLookupBits, maxRest);
+        const std::size_t sub = table.entries.size();
+        table.entries.resize(sub + (std::size_t(1) << subBits), DecodeEntry{ 0, 0, 0 });
+        table.entries[base + group.first] = DecodeEntry{ static_cast<std::uint32_t>(sub), static_cast<std::uint8_t>(bits), static_cast<std::uint8_t>(subBits) };
+
+        buildDecodeLevel(table, sub, subBits, shift + bits, group.second);
+    }
+}
+
+/**
+ * @brief Получить карту частот символов в тексте
+ * @param text входной текст
+ * @return std::map<Symbol, std::size_t> карта частот символов в тексте
+ */
+std::map<Huffman::Symbol, std::size_t> Huffman::getFreq(std::string_view text)
+{
+    // Считаем в плоский массив, а в карту переносим только встретившиеся символы
+    return getFreq(buildHistogram(text.data(), text.size()));
+}
+
+/**
+ * @brief Получить карту частот символов по гистограмме
+ * @param histogram Гистограмма байтов
+ * @return std::map<Symbol, std::size_t> карта частот встретившихся символов
+ */
+std::map<Huffman::Symbol, std::size_t> Huffman::getFreq(const Histogram& histogram)
+{
+    std::map<Symbol, std::size_t> freq;
+    for (unsigned s = 0; s < 256; ++s)
+        if (histogram[s])
+            freq[static_cast<Symbol>(s)] = histogram[s];
+
+    return freq;
+}
+
+/**
+ * @brief Посчитать гистограмму байтов
+ * На больших входах считаем в четыре гистограммы по очереди и складываем их в конце:
+ * подряд идущие одинаковые байты попадают в разные счетчики, и инкремент не ждет
+ * завершения записи предыдущего инкремента того же счетчика
+ * @param data Данные
+ * @param size Размер данных
+ * @return Huffman::Histogram Гистограмма байтов
+ */
+Huffman::Histogram Huffman::buildHistogram(const char* data, std::size_t size)
+{
+    const auto bytes = reinterpret_cast<const unsigned char*>(data);
+
+    Histogram freq{};
+    if (size < kInterleavedHistogramSize)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+            ++freq[bytes[i]];
+
+        return freq;
+    }
+
+    std::array<Histogram, 4> tables{};
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+
+        ++tables[0][word & 0xFF];
+        ++tables[1][(word >> 8) & 0xFF];
+        ++tables[2][(word >> 16) & 0xFF];
+        ++tables[3][(word >> 24) & 0xFF];
+        ++tables[0][(word >> 32) & 0xFF];
+        ++tables[1][(word >> 40) & 0xFF];
+        ++tables[2][(word >> 48) & 0xFF];
+        ++tables[3][word >> 56];
+    }
+
+    for (; i < size; ++i)
+        ++freq[bytes[i]];
+
+    for (unsigned s = 0; s < 256; ++s)
+        freq[s] += tables[0][s] + tables[1][s] + tables[2][s] + tables[3][s];
+
+    return freq;
+}
+
+/**
+ * @brief Оценить гистограмму блока по выборке
+ * Считаются kSampleSpan байт из каждых kSampleStride, счетчики растягиваются на весь блок.
+ * Символ, которого нет в выборке, все равно может встретиться в блоке, поэтому счетчик
+ * каждого из 256 символов не меньше 1: код есть у любого байта
+ * @param block Блок текста, не короче kMinSampledBlockSize
+ * @return Huffman::Histogram Оценка гистограммы блока
+ */
+Huffman::Histogram Huffman::sampleHistogram(std::string_view block)
+{
+    const auto bytes = reinterpret_cast<const unsigned char*>(block.data());
+
+    std::array<Histogram, 4> tables{};
+    std::uint64_t taken = 0;
+    for (std::size_t i = 0; i + kSampleSpan <= block.size(); i += kSampleStride)
+    {
+        for (std::size_t j = i; j < i + kSampleSpan; j += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, bytes + j, 8);
+
+            ++tables[0][word & 0xFF];
+            ++tables[1][(word >> 8) & 0xFF];
+            ++tables[2][(word >> 16) & 0xFF];
+            ++tables[3][(word >> 24) & 0xFF];
+            ++tables[0][(word >> 32) & 0xFF];
+            ++tables[1][(word >> 40) & 0xFF];
+            ++tables[2][(word >> 48) & 0xFF];
+            ++tables[3][word >> 56];
+        }
+
+        taken += kSampleSpan;
+    }
+
+    Histogram freq;
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        const auto sample = tables[0][s] + tables[1][s] + tables[2][s] + tables[3][s];
+        freq[s] = std::max<std::uint64_t>(1, (sample * block.size() + taken / 2) / taken);
+    }
+
+    return freq;
+}
@@ -0,0 +1,996 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <string>
+#include <map>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <array>
+#include <vector>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <bitset>
+#include <stdexcept>
+
+// Горячие циклы на x86 собираются еще и с BMI2 (сдвиги без флагов) и SSE4.2 (инструкция crc32),
+// нужные выбираются при запуске
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HUFFMAN_BMI2_KERNELS 1
+#define HUFFMAN_TARGET_BMI2 __attribute__((target("bmi,bmi2,sse4.2")))
+#else
+#define HUFFMAN_BMI2_KERNELS 0
+#endif
+
+/**
+ * @brief Пул потоков для параллельной обработки независимых блоков
+ * Задачи раздаются через parallelFor, вызывающий поток работает наравне с потоками пула
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const { return m_workers.size() + 1; }
+
+    void parallelFor(std::size_t count, const std::function<void(std::size_t)>& task);
+
+private:
+    void work();
+    void runTasks();
+
+    std::vector<std::thread> m_workers;
+    // Держит вызывающий parallelFor, пока его задачи не выполнены
+    std::mutex m_callers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(std::size_t)>* m_task = nullptr;
+    std::size_t m_count = 0;
+    std::atomic<std::size_t> m_next{ 0 };
+    std::size_t m_active = 0;
+    std::uint64_t m_generation = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+};
+
+/**
+ * @brief Класс для кодирования/декодирования текста алгоритмом Хаффмана
+ * Закодированный поток двоичный и не зависит от содержимого текста:
+ * метка kMagic, байт версии kFormatVersion, длина всего текста (varint, 0 - неизвестна,
+ * иначе длина + 1), флаги потока (varint), затем блоки. Блок - длина текста и размер тела
+ * (varint), за ними тело. Блок с длиной текста 0 - конец потока, за ним может идти индекс блоков.
+ * Ничего не ищется по содержимому, поэтому в тексте могут быть любые байты
+ */
+class Huffman
+{
+public:
+    // Символ алфавита - байт без знака, поэтому двоичные данные кодируются как есть
+    using Symbol = std::uint8_t;
+
+    // Индекс ноды в Tree::nodes, kNoNode - нет ноды
+    using NodeIndex = std::uint16_t;
+    static constexpr NodeIndex kNoNode = 0xFFFF;
+
+    /**
+     * @brief Нода для дерева Хаффмана
+     * Потомки хранятся индексами в массиве нод дерева, поэтому ни выделений памяти, ни счетчиков ссылок
+     */
+    struct Node
+    {
+        Symbol value;
+        std::size_t freq;
+        NodeIndex left;
+        NodeIndex right;
+    };
+
+    /**
+     * @brief Дерево Хаффмана в массиве фиксированного размера
+     * У полного двоичного дерева с 256 листьями 511 нод.
+     * Потомки всегда лежат в массиве раньше родителя, корень - последним
+     */
+    struct Tree
+    {
+        std::array<Node, 511> nodes;
+        NodeIndex size = 0;
+        NodeIndex root = kNoNode;
+    };
+
+    // Длины кодов символов, 0 - символ не встречается
+    using CodeLengths = std::array<unsigned char, 256>;
+
+    // Гистограмма байтов: счетчик для каждого из 256 значений
+    using Histogram = std::array<std::uint64_t, 256>;
+
+    /**
+     * @brief Код символа для кодирования: младшие length бит слова bits
+     */
+    struct Code
+    {
+        std::uint32_t bits;
+        std::uint8_t length;
+    };
+
+    // Коды всех байтов, у отсутствующих length == 0
+    using CodeTable = std::array<Code, 256>;
+
+    // Символ широкого алфавита: два соседних байта текста, первый - младший
+    using WideSymbol = std::uint16_t;
+    static constexpr std::size_t kWideAlphabetSize = std::size_t(1) << 16;
+
+    // Метка начала закодированного потока и версия формата за ней
+    static constexpr char kMagic[] = "het";
+    static constexpr std::size_t kMagicSize = 3;
+    static constexpr unsigned char kFormatVersion = 3;
+    // В версии 1 не было длины всего текста, в версии 2 - флагов, такие потоки тоже декодируются
+    static constexpr unsigned char kMinFormatVersion = 1;
+    // Флаг потока: после конца потока записан индекс блоков для decodeRange
+    static constexpr std::uint64_t kSeekIndexFlag = 1;
+    // Флаг потока: последние 4 байта тела каждого блока - CRC32C его текста (little-endian)
+    static constexpr std::uint64_t kChecksumFlag = 2;
+    static constexpr std::uint64_t kKnownFlags = kSeekIndexFlag | kChecksumFlag;
+
+    // Размер блока, который кодируется со своими частотами
+    static constexpr std::size_t kBlockSize = std::size_t(1) << 20;
+    // Больше блоки не принимаются при декодировании, чтобы память оставалась ограниченной
+    static constexpr std::size_t kMaxBlockSize = std::size_t(1) << 26;
+    // Наибольшая добавка к размеру блока: заголовок блока, тип, таблица переходов, добивка потоков,
+    // контрольная сумма и запись в индексе блоков.
+    // Коды выбираются, только если они короче хранения как есть, поэтому длины кодов в нее не входят
+    static constexpr std::size_t kMaxBlockOverhead = 64;
+    // Наибольший размер заголовка потока, блока конца потока и обрамления индекса блоков
+    static constexpr std::size_t kMaxStreamOverhead = 40;
+
+    // Ограничение длины кода по умолчанию: все коды помещаются в одну таблицу декодирования
+    static constexpr unsigned kDefaultMaxCodeLength = 11;
+    // Допустимые ограничения длины кода: 2^8 кодов хватает на все байты, 32 бита - предел
+    static constexpr unsigned kMinCodeLengthLimit = 8;
+    static constexpr unsigned kMaxCodeLengthLimit = 32;
+
+    // Приблизительная модель (Settings::sampled): частоты считаются по kSampleSpan байтам
+    // из каждых kSampleStride, блоки короче kMinSampledBlockSize считаются целиком
+    static constexpr std::size_t kSampleSpan = 64;
+    static constexpr std::size_t kSampleStride = 1024;
+    static constexpr std::size_t kMinSampledBlockSize = std::size_t(1) << 16;
+
+    /**
+     * @brief Параметры кодирования
+     */
+    struct Settings
+    {
+        // Размер блока, не больше kMaxBlockSize
+        std::size_t blockSize = kBlockSize;
+        // Наибольшая длина кода, от kMinCodeLengthLimit до kMaxCodeLengthLimit
+        unsigned maxCodeLength = kDefaultMaxCodeLength;
+        // Делить блоки от kMinInterleavedBlockSize байт на четыре независимых битовых потока
+        bool interleaved = true;
+        // Порядок модели: 0 - одна таблица кодов на блок, 1 - таблицы по предыдущему байту
+        unsigned order = 0;
+        // Ширина символа в байтах: 1, или 2 - пробовать коды по парам байтов (WideBlock)
+        unsigned symbolWidth = 1;
+        // Записать после конца потока индекс блоков, чтобы decodeRange не обходил заголовки блоков
+        bool seekIndex = false;
+        // Приблизительная модель порядка 0: коды строятся по выборке из блока, и блок читается
+        // один раз - при записи кодов. Сжатие чуть хуже, коды предыдущего блока не берутся
+        bool sampled = false;
+        // Записать в каждый блок CRC32C его текста, декодер сверяет ее с декодированным текстом
+        bool checksum = false;
+    };
+
+    /**
+     * @brief Счетчики кодирования и декодирования, накапливаются от вызова к вызову
+     * Заполняются только при сборке библиотеки с HUFFMAN_STATS (см. statsEnabled). Время фаз - суммарное по всем блокам,
+     * параллельные фазы меряются по часам вызывающего потока
+     */
+    struct Stats
+    {
+        std::uint64_t bytesIn = 0;
+        std::uint64_t bytesOut = 0;
+        std::uint64_t blocks = 0;
+        // Блоки, записанные без кодов (RawBlock, RunBlock), и блоки с кодами предыдущего блока
+        std::uint64_t storedBlocks = 0;
+        std::uint64_t reusedTables = 0;
+        // Блоки с моделью порядка 1 и блоки с кодами по парам байтов
+        std::uint64_t contextBlocks = 0;
+        std::uint64_t wideBlocks = 0;
+        // Блоки с кодами по выборке (только при кодировании), их символы в счетчики ниже не входят
+        std::uint64_t sampledBlocks = 0;
+        // Встретившиеся символы и длины их кодов (средняя длина - только при кодировании)
+        std::bitset<256> symbols;
+        unsigned maxCodeLength = 0;
+        std::uint64_t codedSymbols = 0;
+        std::uint64_t codedBits = 0;
+        // Время фаз в наносекундах
+        std::uint64_t histogramNs = 0;
+        std::uint64_t treeNs = 0;
+        std::uint64_t codesNs = 0;
+        std::uint64_t emitNs = 0;
+        std::uint64_t headerNs = 0;
+        std::uint64_t decodeNs = 0;
+        // Выделения памяти во всем процессе за время вызовов, по счетчику из setAllocationCounter
+        std::uint64_t allocations = 0;
+
+        std::size_t distinctSymbols() const { return symbols.count(); }
+        double averageCodeLength() const { return codedSymbols ? static_cast<double>(codedBits) / static_cast<double>(codedSymbols) : 0; }
+    };
+
+    /**
+     * @brief Потоковый кодировщик
+     * Вход режется на блоки по blockSize байт, каждый блок кодируется по своим частотам
+     * или, если так заведомо короче, кодами предыдущего блока.
+     * В памяти держится только неполный блок и блоки из текущей порции входа.
+     * С пулом потоков блоки одной порции кодируются параллельно
+     */
+    class Encoder
+    {
+    public:
+        explicit Encoder(ThreadPool* pool = nullptr);
+        explicit Encoder(const Settings& settings, ThreadPool* pool = nullptr);
+
+        void update(std::string_view data, std::string& out);
+        void finish(std::string& out);
+
+        void setStats(Stats* stats) { m_stats = stats; }
+        void setContentSize(std::uint64_t size);
+
+    private:
+        // Как кодируется накопленный блок: его гистограммы и выбранные коды
+        struct BlockPlan;
+
+        void reset(const Settings& settings, ThreadPool* pool);
+        std::size_t encodeInto(std::string_view text, char* out, std::size_t capacity);
+        template <typename Output>
+        void write(std::string_view data, Output& out);
+        template <typename Output>
+        void writeEnd(Output& out);
+        template <typename Output>
+        void start(Output& out);
+        template <typename Output>
+        void encodeBlocks(Output& out);
+        void planBlock(std::string_view block, BlockPlan& plan);
+        std::uint64_t planOrder0(std::string_view block, BlockPlan& plan);
+
+        Settings m_settings;
+        ThreadPool* m_pool;
+        std::string m_block;
+        std::vector<std::string_view> m_pending;
+        std::vector<BlockPlan> m_plans;
+        std::vector<std::string> m_results;
+        // Коды последнего блока, записанного со своими длинами кодов
+        CodeTable m_previous;
+        bool m_hasPrevious = false;
+        // Индекс блоков потока без числа блоков, номер следующего блока и последнего со своими длинами
+        std::string m_index;
+        std::uint64_t m_blockCount = 0;
+        std::uint64_t m_lengthsBlock = 0;
+        // Длина всего текста, если она известна заранее
+        std::uint64_t m_contentSize = 0;
+        bool m_hasContentSize = false;
+        bool m_started = false;
+        Stats* m_stats = nullptr;
+
+        friend class Huffman;
+    };
+
+    /**
+     * @brief Потоковый декодировщик
+     * Копит вход до конца очередного блока, декодирует его и отдает результат.
+     * Размеры блоков записаны в их заголовках, поэтому все целые блоки порции
+     * находятся одним проходом и с пулом потоков декодируются параллельно
+     */
+    class Decoder
+    {
+    public:
+        explicit Decoder(ThreadPool* pool = nullptr);
+
+        void update(std::string_view data, std::string& out);
+        void finish(std::string& out);
+
+        void setStats(Stats* stats) { m_stats = stats; }
+
+    private:
+        // Найденный во входе целый блок: тип, номер длин кодов в m_lengths, закодированный текст
+        // и контрольная сумма текста, если она есть в потоке
+        struct Block
+        {
+            unsigned char type;
+            std::size_t lengths;
+            std::string_view payload;
+            std::size_t count;
+            std::size_t offset;
+            std::uint32_t checksum;
+        };
+
+        void reset(ThreadPool* pool);
+        std::size_t decodeBlocks(std::string_view data, std::string& out);
+        std::size_t decodeInto(std::string_view data, char* out, std::size_t capacity);
+        std::size_t scanBlocks(std::string_view data, std::size_t& total);
+        static bool skipSeekIndex(std::string_view data, std::size_t& pos);
+        void decodeScanned(char* out);
+        void finishStream();
+
+        ThreadPool* m_pool;
+        std::string m_buffer;
+        std::vector<Block> m_blocks;
+        // Длины кодов блоков порции, последние переходят в следующую порцию
+        std::vector<CodeLengths> m_lengths;
+        // Длина всего текста из заголовка потока и сколько уже декодировано
+        std::uint64_t m_expected = 0;
+        bool m_hasExpected = false;
+        std::uint64_t m_decoded = 0;
+        bool m_hasIndex = false;
+        bool m_hasChecksums = false;
+        bool m_started = false;
+        bool m_finished = false;
+        Stats* m_stats = nullptr;
+
+        friend class Huffman;
+    };
+
+    /**
+     * @brief Рабочий контекст для встраивания в сервис: кодировщик, декодировщик и буфер результата
+     * Все, что кодировщик и декодировщик выделяют под поток, переживает вызов, поэтому после
+     * первых вызовов память больше не выделяется. Контексты не делят между собой состояние,
+     * разные потоки работают каждый со своим контекстом одновременно, а один контекст
+     * одновременно используется одним потоком
+     */
+    class Context
+    {
+    public:
+        explicit Context(ThreadPool* pool = nullptr);
+        explicit Context(const Settings& settings, ThreadPool* pool = nullptr);
+
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+
+        void reset(const Settings& settings, ThreadPool* pool = nullptr);
+        const Settings& settings() const { return m_settings; }
+        void setStats(Stats* stats);
+
+        std::string_view encode(std::string_view text);
+        std::size_t encode(std::string_view text, char* out, std::size_t capacity);
+        std::string_view decode(std::string_view text);
+        std::size_t decode(std::string_view text, char* out, std::size_t capacity);
+
+    private:
+        Settings m_settings;
+        ThreadPool* m_pool;
+        Encoder m_encoder;
+        Decoder m_decoder;
+        // Результат последнего encode/decode без буфера вызывающего
+        std::string m_buffer;
+    };
+
+    /**
+     * @brief Заранее обученная таблица кодов для коротких сообщений
+     * Определена после класса Huffman
+     */
+    class Dictionary;
+
+    /**
+     * @brief Таблица кодов, построенная при компиляции по заранее известным частотам
+     * Определена после класса Huffman
+     */
+    template <unsigned MaxCodeLength = kDefaultMaxCodeLength>
+    class StaticCode;
+
+    static std::string encode(std::string_view text, ThreadPool* pool = nullptr);
+    static std::string encode(std::string_view text, const Settings& settings, ThreadPool* pool = nullptr, Stats* stats = nullptr);
+    static std::string decode(std::string_view text, ThreadPool* pool = nullptr, Stats* stats = nullptr);
+
+    static std::size_t maxEncodedSize(std::size_t size);
+    static std::size_t maxEncodedSize(std::size_t size, const Settings& settings);
+    static std::size_t encode(std::string_view text, char* out, std::size_t capacity, ThreadPool* pool = nullptr);
+    static std::size_t encode(std::string_view text, char* out, std::size_t capacity, const Settings& settings, ThreadPool* pool = nullptr);
+    static std::size_t decode(std::string_view text, char* out, std::size_t capacity, ThreadPool* pool = nullptr);
+    static std::uint64_t decodedSize(std::string_view text);
+    static std::string decodeRange(std::string_view text, std::uint64_t offset, std::size_t length, ThreadPool* pool = nullptr);
+
+    static std::string encode(std::string_view text, const Dictionary& dictionary);
+    static std::string decode(std::string_view text, const Dictionary& dictionary);
+    static std::uint32_t dictionaryId(std::string_view text);
+
+    template <unsigned MaxCodeLength>
+    static std::string encode(std::string_view text, const StaticCode<MaxCodeLength>& code);
+    template <unsigned MaxCodeLength>
+    static std::string decode(std::string_view text, const StaticCode<MaxCodeLength>& code);
+
+    static const char* kernelName();
+    static bool selectKernels(std::string_view name);
+
+    // Счетчик выделений памяти всего процесса: его ведет программа, а не библиотека
+    using AllocationCounter = std::uint64_t (*)();
+
+    static bool statsEnabled();
+    static void setAllocationCounter(AllocationCounter counter);
+
+private:
+    /**
+     * @brief Буфер вызывающего, в который Encoder пишет поток так же, как в строку
+     * Место проверяется перед каждой записью, поэтому за конец буфера ничего не пишется
+     */
+    class OutputBuffer
+    {
+    public:
+        OutputBuffer(char* data, std::size_t capacity) : m_data(data), m_capacity(capacity) {}
+
+        std::size_t size() const { return m_size; }
+        void append(const char* data, std::size_t size);
+        OutputBuffer& operator+=(std::string_view data) { append(data.data(), data.size()); return *this; }
+        OutputBuffer& operator+=(char c) { append(&c, 1); return *this; }
+
+    private:
+        char* m_data;
+        std::size_t m_capacity;
+        std::size_t m_size = 0;
+    };
+
+    /**
+     * @brief Учет байтов и выделений памяти за один вызов update/finish
+     * Без HUFFMAN_STATS ничего не делает
+     * @tparam Output std::string или OutputBuffer, в который вызов дописывает результат
+     */
+    template <typename Output>
+    class StatsScope
+    {
+    public:
+        StatsScope(Stats* stats, std::size_t bytesIn, const Output& out);
+        ~StatsScope();
+
+        StatsScope(const StatsScope&) = delete;
+        StatsScope& operator=(const StatsScope&) = delete;
+
+    private:
+        Stats* m_stats;
+        const Output& m_out;
+        std::size_t m_outSize;
+        std::uint64_t m_allocations;
+    };
+
+    template <typename Function>
+    static void measure(Stats* stats, std::uint64_t Stats::*phase, Function&& function);
+
+    /**
+     * @brief Упаковщик кодов в битовый поток
+     * Пишет в заранее выделенный буфер точного размера, без проверок места.
+     * Биты копятся в младших разрядах 64-битного слова, по 32 готовых бита выгружаются в буфер
+     * (старший бит идет первым)
+     */
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(char* out) : m_out(reinterpret_cast<unsigned char*>(out)) {}
+
+        void write(std::uint32_t bits, unsigned count);
+        char* flush();
+
+    private:
+        unsigned char* m_out;
+        std::uint64_t m_acc = 0;
+        unsigned m_count = 0;
+    };
+
+    /**
+     * @brief Гистограммы блока: отдельно по каждому битовому потоку и общая
+     * У блока по выборке (sampled) есть только общая, оценочная, и в ней нет нулей
+     */
+    struct BlockHistograms
+    {
+        std::size_t streams;
+        bool sampled = false;
+        std::array<Histogram, 4> stream;
+        Histogram total;
+    };
+
+    /**
+     * @brief Код символа для построения таблицы декодирования: младшие length бит слова bits
+     * Символ - байт (CodeWord) или пара байтов (WideCodeWord)
+     */
+    template <typename SymbolT>
+    struct BasicCodeWord
+    {
+        SymbolT symbol;
+        std::uint64_t bits;
+        unsigned length;
+    };
+
+    using CodeWord = BasicCodeWord<Symbol>;
+    using WideCodeWord = BasicCodeWord<WideSymbol>;
+
+    /**
+     * @brief Элемент таблицы декодирования
+     * Лист (subBits == 0): value - символ, length - сколько бит съесть.
+     * Ссылка: value - начало подтаблицы, length - сколько бит съесть перед переходом в нее,
+     * subBits - сколько следующих бит индексирует подтаблица
+     */
+    struct DecodeEntry
+    {
+        std::uint32_t value;
+        std::uint8_t length;
+        std::uint8_t subBits;
+    };
+
+    /**
+     * @brief Многоуровневая таблица декодирования
+     * Первые rootBits бит индексируют корневую таблицу в начале entries, длинные коды уходят в подтаблицы
+     */
+    struct DecodeTable
+    {
+        std::vector<DecodeEntry> entries;
+        unsigned rootBits;
+    };
+
+    // Сколько бит за раз смотрит таблица декодирования. 2^11 элементов по 8 байт помещаются в L1
+    static constexpr unsigned kLookupBits = 11;
+
+    /**
+     * @brief Чтение битового потока, записанного BitWriter
+     * За концом данных читаются нули
+     */
+    class BitReader
+    {
+    public:
+        BitReader(const char* data, std::size_t size) : m_data(reinterpret_cast<const unsigned char*>(data)), m_size(size) {}
+
+        std::uint64_t peek(unsigned count);
+        void skip(unsigned count);
+
+    private:
+        void refill();
+
+        const unsigned char* m_data;
+        std::size_t m_size;
+        std::size_t m_pos = 0;
+        std::uint64_t m_acc = 0;
+        unsigned m_count = 0;
+    };
+
+    // Типы блоков, первый байт тела блока
+    enum BlockType : unsigned char
+    {
+        SingleStreamBlock = 0, // один битовый поток
+        FourStreamBlock = 1,   // четыре битовых потока по четверти блока, перед ними размеры первых трех
+        RawBlock = 2,          // текст без кодирования: сжатие не окупает заголовок
+        RunBlock = 3,          // блок из одного повторенного символа: сам символ
+        ContextBlock = 4,      // коды выбираются по предыдущему байту: число таблиц, карта контекстов, таблицы, поток
+        WideBlock = 5          // коды пар байтов: число символов, пары (разность символов, длина), нечетный байт, поток
+    };
+
+    // Сколько таблиц кодов может быть у блока с контекстами: номер таблицы помещается в 4 бита
+    static constexpr std::size_t kMaxContextTables = 16;
+    // Сколько байт блока приходится на одну таблицу: меньшим блокам заголовок таблицы дороже выигрыша
+    static constexpr std::size_t kContextTableBytes = 4096;
+    // Корневые таблицы декодирования контекстов меньше обычных, чтобы все вместе помещались в кэш
+    static constexpr unsigned kContextLookupBits = 9;
+
+    /**
+     * @brief Модель порядка 1 для блока: контексты (предыдущие байты) разбиты на группы,
+     * у каждой группы своя таблица кодов
+     */
+    struct ContextModel
+    {
+        std::size_t tables;
+        std::array<std::uint8_t, 256> map;
+        std::array<CodeTable, kMaxContextTables> codes;
+        // Размер закодированного текста и всего тела блока в битах
+        std::uint64_t payloadBits;
+        std::uint64_t bits;
+    };
+
+    /**
+     * @brief Коды блока по парам байтов
+     * Алфавит из 2^16 символов почти всегда заполнен редко, поэтому длины кодов
+     * записываются только для встретившихся символов
+     */
+    struct WideModel
+    {
+        // Встретившиеся символы по возрастанию и коды всего алфавита, у отсутствующих length == 0
+        std::vector<WideSymbol> symbols;
+        std::vector<Code> codes;
+        // Размер закодированного текста и всего тела блока в битах
+        std::uint64_t payloadBits;
+        std::uint64_t bits;
+    };
+
+    // Флаг в первом байте тела блока: длин кодов нет, блок закодирован кодами предыдущего блока
+    static constexpr unsigned char kReuseTableFlag = 0x80;
+
+    // С какого размера блок делится на четыре потока: меньшим блокам таблица переходов дороже выигрыша
+    static constexpr std::size_t kMinInterleavedBlockSize = 1024;
+
+    // Способы записи длин кодов в заголовке
+    enum LengthsFormat : unsigned char
+    {
+        SparseLengths = 0, // число символов и пары (символ, длина)
+        NibbleLengths = 1, // 256 длин по 4 бита
+        ByteLengths = 2    // 256 длин по байту
+    };
+
+    static Tree generateHuffmanTree(const std::map<Symbol, std::size_t>& freq);
+    static Tree generateHuffmanTree(const Histogram& histogram);
+    static CodeTable generateHuffmanCodes(const Tree& tree, unsigned maxCodeLength);
+    static void limitCodeLengths(const Tree& tree, unsigned maxCodeLength, CodeLengths& lengths);
+    static void generateCodeLengths(const Tree& tree, CodeLengths& lengths);
+    template <typename SymbolT, typename Lengths>
+    static void generateCanonicalCodes(const Lengths& lengths, std::vector<BasicCodeWord<SymbolT>>& order);
+    static void generateWideCodeLengths(const std::vector<std::uint32_t>& counts, const std::vector<WideSymbol>& symbols, unsigned maxCodeLength, std::vector<unsigned char>& lengths);
+    static void writeCodeLengths(std::string& out, const CodeTable& huffmanCode);
+    static std::size_t codeLengthsSize(const CodeTable& huffmanCode);
+    static CodeLengths readCodeLengths(std::string_view text, std::size_t& i);
+    static void putVarint(std::string& out, std::uint64_t value);
+    static void putVarint(OutputBuffer& out, std::uint64_t value);
+    static std::uint64_t getVarint(std::string_view text, std::size_t& i);
+    static bool tryGetVarint(std::string_view text, std::size_t& i, std::uint64_t& value);
+    static void encodeBlock(std::string_view block, Encoder::BlockPlan& plan, std::string& body);
+    static void planContext(std::string_view block, unsigned maxCodeLength, ContextModel& model);
+    static void emitContextBlock(std::string_view block, const ContextModel& model, std::string& body);
+    static void decodeContextBlock(std::string_view block, std::size_t count, char* out);
+    static void planWide(std::string_view block, unsigned maxCodeLength, WideModel& model);
+    static void emitWideBlock(std::string_view block, const WideModel& model, std::string& body);
+    static void decodeWideBlock(std::string_view block, std::size_t count, char* out);
+    static BlockHistograms countBlock(std::string_view block, const Settings& settings);
+    static bool canReuseTable(const Histogram& histogram, const CodeTable& previous);
+    static bool preferReusedTable(const Histogram& histogram, const CodeTable& previous, const CodeTable& huffmanCode);
+    static std::uint64_t codedBits(const Histogram& histogram, const CodeTable& huffmanCode);
+    static double lowerBoundBits(const Histogram& histogram);
+    static bool emitBlock(std::string_view block, const BlockHistograms& histograms, const CodeTable& huffmanCode, bool reuseTable, std::string& body);
+    static bool emitSampledStreams(std::string_view block, std::size_t streams, const CodeTable& huffmanCode, std::string& body);
+    static char* emitStream(std::string_view text, const CodeTable& huffmanCode, char* out);
+    static char* emitStreams(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out);
+    static void decodeStreams(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out);
+    static std::size_t streamSize(const Histogram& histogram, const CodeTable& huffmanCode);
+    template <typename SymbolT>
+    static SymbolT decodeSymbol(BitReader& reader, const DecodeTable& table);
+    static void decodeBlock(unsigned char type, const CodeLengths& lengths, std::string_view payload, std::size_t count, char* out);
+    template <typename SymbolT>
+    static void buildDecodeTable(const std::vector<BasicCodeWord<SymbolT>>& codes, DecodeTable& table, unsigned lookupBits = kLookupBits);
+    template <typename SymbolT>
+    static void buildDecodeLevel(DecodeTable& table, std::size_t base, unsigned bits, unsigned shift, const std::vector<BasicCodeWord<SymbolT>>& codes);
+    static std::map<Symbol, std::size_t> getFreq(std::string_view text);
+    static std::map<Symbol, std::size_t> getFreq(const Histogram& histogram);
+    static Histogram buildHistogram(const char* data, std::size_t size);
+    static Histogram sampleHistogram(std::string_view block);
+
+    // Таблицы CRC32C для расчета по 8 байт за шаг
+    using ChecksumTables = std::array<std::array<std::uint32_t, 256>, 8>;
+    static constexpr ChecksumTables makeChecksumTables();
+    // Длина каждой из трех дорожек, которые считает checksumBmi2, и таблицы сдвига CRC на дорожку
+    static constexpr std::size_t kChecksumLane = 2048;
+    using ChecksumShift = std::array<std::array<std::uint32_t, 256>, 4>;
+    static constexpr ChecksumShift makeChecksumShift();
+    static std::uint32_t checksum(std::string_view text);
+    static void putChecksum(std::string& out, std::uint32_t checksum);
+    static std::uint32_t takeChecksum(std::string_view& body);
+
+    /**
+     * @brief Ядра горячих циклов: запись и чтение битовых потоков блока и контрольная сумма
+     * Один и тот же код собирается под разные наборы инструкций,
+     * лучший доступный набор выбирается по процессору при первом использовании
+     */
+    struct Kernels
+    {
+        const char* name;
+        char* (*emit)(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out);
+        void (*decode)(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out);
+        std::uint32_t (*checksum)(std::string_view text);
+    };
+
+    /**
+     * @brief Блок потока для decodeRange: где лежит и какой текст дает
+     */
+    struct SeekPoint
+    {
+        std::uint64_t offset;
+        std::size_t count;
+        // Позиция заголовка блока в потоке и номер блока с длинами кодов для блока с флагом kReuseTableFlag
+        std::size_t position;
+        std::size_t lengths;
+    };
+
+    static constexpr std::size_t kNoSeekPoint = ~std::size_t(0);
+
+    static std::size_t readStreamHeader(std::string_view text, std::uint64_t& flags);
+    static std::string_view readBlock(std::string_view text, std::size_t& position, std::uint64_t& count);
+    static void readSeekIndex(std::string_view text, std::size_t first, std::vector<SeekPoint>& points);
+    static void scanSeekPoints(std::string_view text, std::size_t first, std::vector<SeekPoint>& points);
+    static void decodeSeekBlock(std::string_view text, const std::vector<SeekPoint>& points, std::size_t b, bool checksums, char* out);
+
+    static const Kernels kGenericKernels;
+    static char* emitStreamsGeneric(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out);
+    static void decodeStreamsGeneric(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out);
+    static std::uint32_t checksumGeneric(std::string_view text);
+#if HUFFMAN_BMI2_KERNELS
+    static const Kernels kBmi2Kernels;
+    HUFFMAN_TARGET_BMI2 static char* emitStreamsBmi2(std::string_view block, const CodeTable& huffmanCode, std::size_t streams, char** out);
+    HUFFMAN_TARGET_BMI2 static void decodeStreamsBmi2(BitReader* readers, std::size_t streams, const DecodeTable& table, std::size_t count, char* out);
+    HUFFMAN_TARGET_BMI2 static std::uint32_t checksumBmi2(std::string_view text);
+#endif
+    static std::atomic<const Kernels*>& activeKernels();
+    static const Kernels& kernels() { return *activeKernels().load(std::memory_order_relaxed); }
+
+    // С какого размера входа частоты считаются в несколько чередующихся гистограмм
+    static constexpr std::size_t kInterleavedHistogramSize = 4096;
+
+    // Замер скорости гоняет отдельные фазы кодирования
+    friend class Benchmark;
+};
+
+/**
+ * @brief Как кодируется накопленный блок
+ */
+struct Huffman::Encoder::BlockPlan
+{
+    BlockType type;
+    BlockHistograms histograms;
+    CodeTable huffmanCode;
+    bool reuseTable;
+    // Заполняется только при Settings::order == 1
+    ContextModel context;
+    // Заполняется только при Settings::symbolWidth == 2
+    WideModel wide;
+};
+
+/**
+ * @brief Заранее обученная таблица кодов для коротких сообщений
+ * Обучается один раз на образце, сохраняется и загружается при старте.
+ * Сообщение, закодированное по словарю, несет только номер словаря и длину текста:
+ * ни длин кодов в заголовке, ни построения дерева на каждое сообщение
+ */
+class Huffman::Dictionary
+{
+public:
+    static Dictionary train(std::string_view sample, std::uint32_t id, unsigned maxCodeLength = kDefaultMaxCodeLength);
+    static Dictionary train(const Histogram& histogram, std::uint32_t id, unsigned maxCodeLength = kDefaultMaxCodeLength);
+    static Dictionary load(std::string_view data);
+
+    std::string serialize() const;
+    std::uint32_t id() const { return m_id; }
+
+private:
+    Dictionary(std::uint32_t id, const CodeLengths& lengths);
+
+    std::uint32_t m_id;
+    CodeTable m_codes;
+    DecodeTable m_table;
+    unsigned m_maxLength = 0;
+
+    friend class Huffman;
+};
+
+/**
+ * @brief Таблица кодов, построенная при компиляции по заранее известным частотам
+ * Для полей протоколов с постоянным распределением: коды и таблица декодирования
+ * вычисляются constexpr-конструктором и лежат в двоичном файле готовыми, а сообщение
+ * несет только длину текста. Байтам, которых нет в частотах, тоже достается код, как в Dictionary
+ * @tparam MaxCodeLength Наибольшая длина кода: все коды декодируются одной таблицей
+ * на 2^MaxCodeLength элементов, а два кода подряд пишутся одной записью
+ */
+template <unsigned MaxCodeLength>
+class Huffman::StaticCode
+{
+public:
+    static_assert(MaxCodeLength >= kMinCodeLengthLimit && MaxCodeLength <= kLookupBits, "Static code length must fit one decode table.");
+
+    constexpr explicit StaticCode(const Histogram& histogram);
+
+    // Код байта, доступен и при компиляции - например, для static_assert
+    constexpr Code code(unsigned char symbol) const { return m_codes[symbol]; }
+
+private:
+    CodeTable m_codes{};
+    std::array<DecodeEntry, std::size_t(1) << MaxCodeLength> m_table{};
+
+    friend class Huffman;
+};
+
+/**
+ * @brief Построить коды и таблицу декодирования
+ * Те же шаги, что у generateHuffmanTree и generateHuffmanCodes, но без рабочих буферов
+ * и сортировки стандартной библиотеки, чтобы все вычислялось при компиляции:
+ * листья сортируются вставками, дерево строится двумя очередями и хранится ссылками
+ * на родителей. Пока код длиннее MaxCodeLength, частоты сглаживаются вдвое и дерево
+ * строится заново - при равных частотах все 256 кодов длиной 8
+ * @param histogram Частоты байтов
+ */
+template <unsigned MaxCodeLength>
+constexpr Huffman::StaticCode<MaxCodeLength>::StaticCode(const Histogram& histogram)
+{
+    // Листья занимают [0, 256) по возрастанию частоты, при равенстве - по символу,
+    // внутренние ноды - [256, 511) в порядке появления, корень последний
+    Symbol leaves[256] = {};
+    std::uint64_t freq[511] = {};
+    std::size_t parent[511] = {};
+    unsigned depths[511] = {};
+
+    for (unsigned s = 0; s < 256; ++s)
+    {
+        std::size_t k = s;
+        for (; k > 0 && histogram[leaves[k - 1]] > histogram[s]; --k)
+            leaves[k] = leaves[k - 1];
+
+        leaves[k] = static_cast<Symbol>(s);
+    }
+
+    for (std::size_t k = 0; k < 256; ++k)
+        freq[k] = histogram[leaves[k]] + 1;
+
+    while (true)
+    {
+        std::size_t leaf = 0;
+        std::size_t node = 256;
+        for (std::size_t next = 256; next < 511; ++next)
+        {
+            freq[next] = 0;
+            for (int child = 0; child < 2; ++child)
+            {
+                const auto take = leaf < 256 && (node == next || freq[leaf] <= freq[node]) ? leaf++ : node++;
+                freq[next] += freq[take];
+                parent[take] = next;
+            }
+        }
+
+        unsigned maxDepth = 0;
+        for (std::size_t k = 510; k-- > 0;)
+        {
+            depths[k] = depths[parent[k]] + 1;
+            maxDepth = maxDepth < depths[k] ? depths[k] : maxDepth;
+        }
+
+        if (maxDepth <= MaxCodeLength)
+            break;
+
+        for (std::size_t k = 0; k < 256; ++k)
+            freq[k] = freq[k] >> 1 | 1;
+    }
+
+    for (std::size_t k = 0; k < 256; ++k)
+        m_codes[leaves[k]].length = static_cast<std::uint8_t>(depths[k]);
+
+    // Канонические коды по (длине, символу), как generateCanonicalCodes.
+    // Код занимает в таблице все элементы, у которых он является префиксом
+    std::uint32_t code = 0;
+    for (unsigned length = 1; length <= MaxCodeLength; ++length, code <<= 1)
+    {
+        for (unsigned s = 0; s < 256; ++s)
+        {
+            if (m_codes[s].length != length)
+                continue;
+
+            m_codes[s].bits = code;
+
+            const std::size_t first = std::size_t(code) << (MaxCodeLength - length);
+            for (std::size_t e = first; e < first + (std::size_t(1) << (MaxCodeLength - length)); ++e)
+                m_table[e] = DecodeEntry{ s, static_cast<std::uint8_t>(length), 0 };
+
+            ++code;
+        }
+    }
+}
+
+/**
+ * @brief Дописать в поток count младших бит из bits
+ * В аккумуляторе всегда меньше 32 бит, поэтому код до 32 бит помещается в него целиком,
+ * а выгрузка - одна запись 4 байт. В буфер попадают только готовые слова, поэтому
+ * соседние потоки можно писать одновременно
+ * @param bits Биты кода (старшие биты выше count должны быть нулевыми)
+ * @param count Количество бит, от 0 до 32
+ */
+inline void Huffman::BitWriter::write(std::uint32_t bits, unsigned count)
+{
+    m_acc = (m_acc << count) | bits;
+    m_count += count;
+
+    // Без ветвления: неполное слово пишется в sink, и предсказателю переходов нечего угадывать
+    const unsigned full = m_count >> 5;
+    m_count -= full * 32;
+    unsigned char sink[4];
+    unsigned char* dst = full ? m_out : sink;
+    const auto word = static_cast<std::uint32_t>(m_acc >> m_count);
+    dst[0] = static_cast<unsigned char>(word >> 24);
+    dst[1] = static_cast<unsigned char>(word >> 16);
+    dst[2] = static_cast<unsigned char>(word >> 8);
+    dst[3] = static_cast<unsigned char>(word);
+    m_out += full * 4;
+}
+
+/**
+ * @brief Посмотреть следующие count бит, не сдвигая позицию
+ * @param count Количество бит, от 1 до 56
+ * @return std::uint64_t Биты, прижатые к младшему краю
+ */
+inline std::uint64_t Huffman::BitReader::peek(unsigned count)
+{
+    if (m_count < count)
+        refill();
+
+    return m_acc >> (64 - count);
+}
+
+/**
+ * @brief Пропустить count бит (не больше, чем было просмотрено через peek)
+ * @param count Количество бит
+ */
+inline void Huffman::BitReader::skip(unsigned count)
+{
+    m_acc <<= count;
+    m_count -= count;
+}
+
+
+/**
+ * @brief Закодировать сообщение таблицей, построенной при компиляции
+ * Сообщение - длина текста (varint) и битовый поток, без заголовка кодов.
+ * Два кода не длиннее MaxCodeLength вместе помещаются в 32 бита и пишутся одной записью
+ * @param text Текст сообщения
+ * @param code Таблица кодов
+ * @return std::string Закодированное сообщение
+ */
+template <unsigned MaxCodeLength>
+std::string Huffman::encode(std::string_view text, const StaticCode<MaxCodeLength>& code)
+{
+    static_assert(2 * MaxCodeLength <= 32, "Two static codes must fit one write.");
+
+    std::string encoded;
+    putVarint(encoded, text.size());
+
+    const auto header = encoded.size();
+    encoded.resize(header + (text.size() * MaxCodeLength + 7) / 8);
+
+    const auto bytes = reinterpret_cast<const unsigned char*>(text.data());
+    BitWriter writer(&encoded[0] + header);
+    std::size_t n = 0;
+    for (; n + 2 <= text.size(); n += 2)
+    {
+        const auto first = code.m_codes[bytes[n]];
+        const auto second = code.m_codes[bytes[n + 1]];
+        writer.write(first.bits << second.length | second.bits, first.length + second.length);
+    }
+
+    if (n < text.size())
+        writer.write(code.m_codes[bytes[n]].bits, code.m_codes[bytes[n]].length);
+
+    const auto end = writer.flush();
+    encoded.resize(static_cast<std::size_t>(end - encoded.data()));
+
+    return encoded;
+}
+
+/**
+ * @brief Декодировать сообщение, закодированное таблицей, построенной при компиляции
+ * Каждый символ - ровно один просмотр таблицы на MaxCodeLength бит, без подтаблиц
+ * @param text Закодированное сообщение
+ * @param code Таблица кодов, которой сообщение закодировано
+ * @return std::string Декодированный текст
+ * @throw std::runtime_error Если сообщение повреждено
+ */
+template <unsigned MaxCodeLength>
+std::string Huffman::decode(std::string_view text, const StaticCode<MaxCodeLength>& code)
+{
+    std::size_t i = 0;
+    const auto count = getVarint(text, i);
+    if (count > 8 * (text.size() - i))
+        throw std::runtime_error("Invalid encoded message.");
+
+    std::string decoded(count, '\0');
+
+    BitReader reader(text.data() + i, text.size() - i);
+    for (std::size_t n = 0; n < count; ++n)
+    {
+        const auto& entry = code.m_table[reader.peek(MaxCodeLength)];
+        reader.skip(entry.length);
+        decoded[n] = static_cast<char>(entry.value);
+    }
+
+    return decoded;
+}
+
+#endif
@@ -0,0 +1,263 @@
+#include "huffman_c.h"
+#include "huffman.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+/**
+ * @brief Контекст C-интерфейса: параметры, свой пул потоков, если он нужен, и текст последней ошибки
+ */
+struct huffman_context
+{
+    Huffman::Settings settings;
+    std::unique_ptr<ThreadPool> pool;
+    Huffman::Context context;
+    std::string error;
+};
+
+namespace
+{
+/**
+ * @brief Выполнить вызов, превратив исключения в код возврата
+ * @param context Контекст, в который записывается текст ошибки
+ * @param function Вызов, возвращающий код
+ * @return huffman_status Код вызова или код пойманного исключения
+ */
+template <typename Function>
+huffman_status guard(huffman_context* context, Function&& function)
+{
+    if (!context)
+        return HUFFMAN_ERROR;
+
+    try
+    {
+        context->error.clear();
+        return function();
+    }
+    catch (const std::bad_alloc&)
+    {
+        context->error = "Out of memory.";
+        return HUFFMAN_NO_MEMORY;
+    }
+    catch (const std::exception& e)
+    {
+        context->error = e.what();
+        return HUFFMAN_ERROR;
+    }
+    catch (...)
+    {
+        context->error = "Unknown error.";
+        return HUFFMAN_ERROR;
+    }
+}
+}
+
+/**
+ * @brief Создать контекст с параметрами по умолчанию и без пула потоков
+ * @return huffman_context* Контекст или NULL, если не хватило памяти
+ */
+huffman_context* huffman_context_create(void)
+{
+    return new (std::nothrow) huffman_context();
+}
+
+/**
+ * @brief Освободить контекст и его пул потоков
+ * @param context Контекст или NULL
+ */
+void huffman_context_destroy(huffman_context* context)
+{
+    delete context;
+}
+
+/**
+ * @brief Задать параметр контекста, действует со следующего вызова
+ * @param context Контекст
+ * @param option Параметр
+ * @param value Значение, неотрицательное
+ * @return huffman_status HUFFMAN_ERROR, если параметр неизвестен или значение отрицательно
+ */
+huffman_status huffman_set_option(huffman_context* context, huffman_option option, int64_t value)
+{
+    return guard(context, [&]
+    {
+        if (value < 0)
+            throw std::runtime_error("Invalid option value.");
+
+        auto& settings = context->settings;
+        switch (option)
+        {
+        case HUFFMAN_OPTION_BLOCK_SIZE:
+            settings.blockSize = static_cast<std::size_t>(std::min<std::uint64_t>(value, Huffman::kMaxBlockSize));
+            break;
+        case HUFFMAN_OPTION_MAX_CODE_LENGTH:
+            settings.maxCodeLength = static_cast<unsigned>(std::min<std::uint64_t>(value, Huffman::kMaxCodeLengthLimit));
+            break;
+        case HUFFMAN_OPTION_INTERLEAVED:
+            settings.interleaved = value != 0;
+            break;
+        case HUFFMAN_OPTION_ORDER:
+            settings.order = static_cast<unsigned>(std::min<std::int64_t>(value, 1));
+            break;
+        case HUFFMAN_OPTION_SYMBOL_WIDTH:
+            settings.symbolWidth = static_cast<unsigned>(std::min<std::int64_t>(value, 2));
+            break;
+        case HUFFMAN_OPTION_SEEK_INDEX:
+            settings.seekIndex = value != 0;
+            break;
+        case HUFFMAN_OPTION_SAMPLED:
+            settings.sampled = value != 0;
+            break;
+        case HUFFMAN_OPTION_CHECKSUM:
+            settings.checksum = value != 0;
+            break;
+        case HUFFMAN_OPTION_THREADS:
+            context->pool.reset();
+            if (value > 1)
+                context->pool.reset(new ThreadPool(static_cast<std::size_t>(value)));
+            break;
+        default:
+            throw std::runtime_error("Unknown option.");
+        }
+
+        context->context.reset(settings, context->pool.get());
+        return HUFFMAN_OK;
+    });
+}
+
+/**
+ * @brief Текст последней ошибки контекста
+ * @param context Контекст
+ * @return const char* Текст, пустой, если последний вызов успешен; действителен до следующего вызова
+ */
+const char* huffman_last_error(const huffman_context* context)
+{
+    return context ? context->error.c_str() : "No context.";
+}
+
+/**
+ * @brief Размер буфера, которого заведомо хватит для huffman_encode с параметрами контекста
+ * @param context Контекст
+ * @param size Длина текста
+ * @return size_t Размер буфера
+ */
+size_t huffman_max_encoded_size(const huffman_context* context, size_t size)
+{
+    return Huffman::maxEncodedSize(size, context ? context->settings : Huffman::Settings());
+}
+
+/**
+ * @brief Закодировать текст
+ * Если capacity не меньше huffman_max_encoded_size, поток пишется прямо в dst,
+ * иначе - в буфер контекста и копируется
+ * @param context Контекст
+ * @param src Текст
+ * @param size Длина текста
+ * @param dst Буфер
+ * @param capacity Размер буфера, хватает huffman_max_encoded_size
+ * @param written Сюда пишется размер закодированного текста или, если буфер мал, нужный размер
+ * @return huffman_status Код возврата
+ */
+huffman_status huffman_encode(huffman_context* context, const void* src, size_t size, void* dst, size_t capacity, size_t* written)
+{
+    return guard(context, [&]
+    {
+        const std::string_view text(static_cast<const char*>(src), size);
+
+        // Места заведомо хватит - пишем прямо в dst, иначе кодируем в буфер контекста, чтобы узнать нужный размер
+        if (capacity >= Huffman::maxEncodedSize(size, context->settings))
+        {
+            const auto encoded = context->context.encode(text, static_cast<char*>(dst), capacity);
+            if (written)
+                *written = encoded;
+
+            return HUFFMAN_OK;
+        }
+
+        const auto encoded = context->context.encode(text);
+        if (written)
+            *written = encoded.size();
+
+        if (encoded.size() > capacity)
+            return HUFFMAN_BUFFER_TOO_SMALL;
+
+        // Пустой результат можно вернуть и в dst == NULL, а memcpy с NULL не определен даже для 0 байт
+        if (!encoded.empty())
+            std::memcpy(dst, encoded.data(), encoded.size());
+
+        return HUFFMAN_OK;
+    });
+}
+
+/**
+ * @brief Узнать длину декодированного текста по заголовку потока
+ * @param src Закодированный текст, достаточно его начала
+ * @param size Размер src
+ * @param decoded Сюда пишется длина
+ * @return huffman_status HUFFMAN_ERROR, если это не закодированный текст или длина в нем не записана
+ */
+huffman_status huffman_decoded_size(const void* src, size_t size, uint64_t* decoded)
+{
+    try
+    {
+        *decoded = Huffman::decodedSize(std::string_view(static_cast<const char*>(src), size));
+        return HUFFMAN_OK;
+    }
+    catch (...)
+    {
+        return HUFFMAN_ERROR;
+    }
+}
+
+/**
+ * @brief Декодировать текст
+ * Если длина текста записана в заголовке, блоки декодируются прямо в dst,
+ * иначе - в буфер контекста и копируются
+ * @param context Контекст
+ * @param src Закодированный текст
+ * @param size Размер закодированного текста
+ * @param dst Буфер
+ * @param capacity Размер буфера, хватает huffman_decoded_size
+ * @param written Сюда пишется длина декодированного текста или, если буфер мал, нужный размер
+ * @return huffman_status Код возврата
+ */
+huffman_status huffman_decode(huffman_context* context, const void* src, size_t size, void* dst, size_t capacity, size_t* written)
+{
+    return guard(context, [&]
+    {
+        const std::string_view text(static_cast<const char*>(src), size);
+
+        std::uint64_t expected = 0;
+        if (huffman_decoded_size(src, size, &expected) == HUFFMAN_OK)
+        {
+            if (expected > capacity)
+            {
+                if (written)
+                    *written = static_cast<std::size_t>(expected);
+
+                return HUFFMAN_BUFFER_TOO_SMALL;
+            }
+
+            const auto decoded = context->context.decode(text, static_cast<char*>(dst), capacity);
+            if (written)
+                *written = decoded;
+
+            return HUFFMAN_OK;
+        }
+
+        const auto decoded = context->context.decode(text);
+        if (written)
+            *written = decoded.size();
+
+        if (decoded.size() > capacity)
+            return HUFFMAN_BUFFER_TOO_SMALL;
+
+        if (!decoded.empty())
+            std::memcpy(dst, decoded.data(), decoded.size());
+
+        return HUFFMAN_OK;
+    });
+}
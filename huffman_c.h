@@ -0,0 +1,77 @@
+#ifndef HUFFMAN_C_H
+#define HUFFMAN_C_H
+
+/*
+ * C-интерфейс библиотеки huffman для встраивания в сервисы.
+ * Контекст держит кодировщик, декодировщик и их память между вызовами: каждый рабочий поток
+ * сервиса создает свой контекст один раз и дальше кодирует без выделений памяти.
+ * Разные контексты можно использовать из разных потоков одновременно, один контекст -
+ * только из одного потока за раз. Исключения наружу не выходят: каждая функция возвращает
+ * код ошибки, а текст последней ошибки контекста отдает huffman_last_error.
+ * Набор функций, значения кодов и опций только дополняются и не меняются
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(HUFFMAN_BUILD_SHARED)
+#define HUFFMAN_API __declspec(dllexport)
+#elif defined(HUFFMAN_SHARED)
+#define HUFFMAN_API __declspec(dllimport)
+#else
+#define HUFFMAN_API
+#endif
+#elif defined(__GNUC__)
+#define HUFFMAN_API __attribute__((visibility("default")))
+#else
+#define HUFFMAN_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Контекст кодирования/декодирования */
+typedef struct huffman_context huffman_context;
+
+/* Коды возврата */
+typedef enum huffman_status
+{
+    HUFFMAN_OK = 0,
+    HUFFMAN_ERROR = 1,            /* поврежденный поток или неверный аргумент */
+    HUFFMAN_BUFFER_TOO_SMALL = 2, /* в *written - сколько места нужно, если это известно */
+    HUFFMAN_NO_MEMORY = 3
+} huffman_status;
+
+/* Параметры контекста, значения по умолчанию - как у Huffman::Settings */
+typedef enum huffman_option
+{
+    HUFFMAN_OPTION_BLOCK_SIZE = 0,      /* размер блока в байтах */
+    HUFFMAN_OPTION_MAX_CODE_LENGTH = 1, /* наибольшая длина кода, от 8 до 32 */
+    HUFFMAN_OPTION_INTERLEAVED = 2,     /* 0/1: четыре битовых потока в больших блоках */
+    HUFFMAN_OPTION_ORDER = 3,           /* порядок модели, 0 или 1 */
+    HUFFMAN_OPTION_SYMBOL_WIDTH = 4,    /* ширина символа в байтах, 1 или 2 */
+    HUFFMAN_OPTION_SEEK_INDEX = 5,      /* 0/1: индекс блоков для произвольного доступа */
+    HUFFMAN_OPTION_SAMPLED = 6,         /* 0/1: коды по выборке из блока */
+    HUFFMAN_OPTION_CHECKSUM = 7,        /* 0/1: CRC32C текста каждого блока */
+    HUFFMAN_OPTION_THREADS = 8          /* потоков на один вызов, 1 - без своего пула */
+} huffman_option;
+
+HUFFMAN_API huffman_context* huffman_context_create(void);
+HUFFMAN_API void huffman_context_destroy(huffman_context* context);
+
+HUFFMAN_API huffman_status huffman_set_option(huffman_context* context, huffman_option option, int64_t value);
+HUFFMAN_API const char* huffman_last_error(const huffman_context* context);
+
+HUFFMAN_API size_t huffman_max_encoded_size(const huffman_context* context, size_t size);
+HUFFMAN_API huffman_status huffman_encode(huffman_context* context, const void* src, size_t size, void* dst, size_t capacity, size_t* written);
+
+HUFFMAN_API huffman_status huffman_decoded_size(const void* src, size_t size, uint64_t* decoded);
+HUFFMAN_API huffman_status huffman_decode(huffman_context* context, const void* src, size_t size, void* dst, size_t capacity, size_t* written);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
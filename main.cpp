@@ -1,298 +1,1421 @@
 #include <iostream>
 #include <string>
-#include <queue>
-#include <map>
 #include <fstream>
 #include <sstream>
 #include <cstring>
-#include <memory>
-#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string_view>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+#include <exception>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <atomic>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HUFFMAN_POSIX_IO 1
+#endif
+#include <stdexcept>
+
+#include "huffman.h"
+#include "corpus.h"
+
+#if HUFFMAN_STATS
+// Выделения памяти через operator new для --stats: считает утилита, библиотека operator new не трогает
+static std::atomic<std::uint64_t> allocationCount{ 0 };
+
+void* operator new(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
 
 /**
- * @brief Класс для кодирования/декодирования текста алгоритмом Хаффмана
+ * @brief Счетчик выделений памяти для Huffman::setAllocationCounter
+ * @return std::uint64_t Сколько раз вызывался operator new
  */
-class Huffman
+static std::uint64_t countAllocations()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+#endif
+
+/**
+ * @brief Ограниченная очередь между стадиями конвейера
+ * Кольцо фиксированного размера: после создания очередь не выделяет память.
+ * Стадия ждет, если класть некуда или брать нечего. После close push ничего не кладет,
+ * а pop отдает то, что осталось, и затем возвращает false
+ * @tparam T Тип элемента
+ */
+template <typename T>
+class BoundedQueue
 {
 public:
+    explicit BoundedQueue(std::size_t capacity) : m_items(capacity) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
     /**
-     * @brief Нода для дерева Хаффмана
-     * Для Ptr использовал shared_ptr чтобы не думать об утечке, shared_ptr сам все разрулит
+     * @brief Положить элемент, дождавшись места
+     * @param item Элемент
+     * @return true Положен, false - очередь закрыта
      */
-    struct Node
+    bool push(T item)
     {
-        using Ptr = std::shared_ptr<Node>;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_closed || m_size < m_items.size(); });
+        if (m_closed)
+            return false;
 
-        char value;
-        std::size_t freq;
-        Node::Ptr left;
-        Node::Ptr right;
-    };
+        m_items[(m_head + m_size) % m_items.size()] = std::move(item);
+        ++m_size;
+        lock.unlock();
+
+        m_notEmpty.notify_one();
+        return true;
+    }
 
-    // Компаратор для очереди с приоритетом.
-    // С ним при вставке в очередь с приоритетом очередь автоматически будет сортироваться по возрастанию частоты символа
-    struct Greater
+    /**
+     * @brief Взять элемент, дождавшись его
+     * @param item Сюда кладется элемент
+     * @return true Взят, false - очередь закрыта и пуста
+     */
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || m_size > 0; });
+        if (m_size == 0)
+            return false;
+
+        item = std::move(m_items[m_head]);
+        m_head = (m_head + 1) % m_items.size();
+        --m_size;
+        lock.unlock();
+
+        m_notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Закрыть очередь и разбудить всех, кто ее ждет
+     */
+    void close()
     {
-        bool operator()(const Node::Ptr& lhs, const Node::Ptr& rhs) const
         {
-            return lhs->freq == rhs->freq ? lhs->value >= rhs->value : lhs->freq > rhs->freq;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
         }
-    };
 
-    using PriorityQueue = std::priority_queue<Node::Ptr, std::vector<Node::Ptr>, Greater>;
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
 
-    static std::string encode(const std::string& text);
-    static std::string decode(const std::string& text);
+private:
+    std::vector<T> m_items;
+    std::size_t m_head = 0;
+    std::size_t m_size = 0;
+    bool m_closed = false;
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+};
+
+/**
+ * @brief Встроенный замер скорости кодирования/декодирования
+ * Гоняет фазы кодировщика по сгенерированным наборам данных и печатает по строке на фазу,
+ * поля разделены табуляцией: набор, размер, фаза, МБ/с, нс/байт, степень сжатия и насколько
+ * за фазу вырос RSS процесса в КБ (после минус до, отрицательно, если память вернулась системе).
+ * Сохраненный вывод служит эталоном: gate находит фазы, которые стали медленнее него
+ */
+class Benchmark
+{
+public:
+    /**
+     * @brief Скорость одной фазы на одном наборе данных
+     */
+    struct Result
+    {
+        std::string corpus;
+        std::size_t size;
+        std::string phase;
+        double mbPerSecond;
+    };
+
+    static std::vector<Result> run(const std::vector<std::size_t>& sizes, std::ostream& os);
+    static bool gate(const std::vector<std::size_t>& sizes, std::istream& baseline, double threshold, std::ostream& os, std::ostream& log);
 
 private:
-    static Node::Ptr generateHuffmanTree(const std::map<char, std::size_t>& freq);
-    static std::map<char, std::string> generateHuffmanCodes(const Node::Ptr& root);
-    static void generateHuffmanCodesImpl(const Node::Ptr& root, const std::string& repr, std::map<char, std::string>& huffmanCode);
-    static std::map<char, std::size_t> getFreq(const std::string& text);
+    static std::vector<Result> readResults(std::istream& is);
+    static std::vector<std::pair<Result, double>> slower(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold);
+    static void measure(const std::string& corpus, const std::string& data, std::ostream& os, std::vector<Result>& results);
+    template <typename Function>
+    static double time(Function&& function);
+    static std::int64_t residentKb();
 
+    // Каждая фаза повторяется, пока не наберется столько секунд, берется лучший прогон
+    static constexpr double kMinSeconds = 0.2;
+    static constexpr unsigned kMinRuns = 3;
+    // Сколько раз gate перемеряет наборы с медленными фазами, прежде чем признать замедление
+    static constexpr unsigned kGateRetries = 2;
 };
 
 /**
- * @brief Закодировать текст
- * @param text Текст для закодирования
- * @return std::string Закодированный текст
+ * @brief Прогнать все наборы данных всех размеров
+ * @param sizes Размеры наборов в байтах
+ * @param os Поток для результатов
+ * @return std::vector<Benchmark::Result> Скорости всех фаз в порядке вывода
  */
-std::string Huffman::encode(const std::string& text)
+std::vector<Benchmark::Result> Benchmark::run(const std::vector<std::size_t>& sizes, std::ostream& os)
 {
-    auto freq = getFreq(text);
-    auto root = generateHuffmanTree(freq);
+    os << "corpus\tsize\tphase\tmb_per_s\tns_per_byte\tratio\trss_delta_kb\n";
 
-    auto huffmanCode = generateHuffmanCodes(root);
+    std::vector<Result> results;
+    for (const auto& corpus : { "random", "zipf", "text", "single", "all256" })
+        for (const auto& size : sizes)
+            measure(corpus, Corpus::generate(corpus, size), os, results);
 
-    // Вставляем заголовок с частотами
-    std::string encoded = "het\n";
+    return results;
+}
 
-    for (const auto& f : freq)
-        encoded += f.first + std::string(" ") + std::to_string(f.second) + '\n';
+/**
+ * @brief Замерить скорость и сравнить ее с эталоном - сохраненным выводом run
+ * Сравниваются только фазы, которые есть в обоих, поэтому из эталона можно убрать строки
+ * шумных фаз. Наборы с фазами, ставшими медленнее больше чем на threshold, перемеряются
+ * до kGateRetries раз, и берется лучшая скорость: одиночный выброс не валит проверку.
+ * О каждой оставшейся медленной фазе пишется строка в log
+ * @param sizes Размеры наборов в байтах
+ * @param baseline Эталон
+ * @param threshold Допустимое замедление, доля от эталонной скорости
+ * @param os Поток для результатов первого замера
+ * @param log Поток для отчета
+ * @return bool Ни одна фаза не стала медленнее допустимого
+ * @throw std::runtime_error Если эталон не разбирается или в нем нет ни одной фазы замера
+ */
+bool Benchmark::gate(const std::vector<std::size_t>& sizes, std::istream& baseline, double threshold, std::ostream& os, std::ostream& log)
+{
+    const auto expected = readResults(baseline);
+    auto results = run(sizes, os);
 
-    encoded += "het\n";
+    std::size_t compared = 0;
+    for (const auto& result : results)
+        for (const auto& base : expected)
+            compared += result.corpus == base.corpus && result.size == base.size && result.phase == base.phase;
 
-    // Вставляем закодированный текст
-    for (const auto& c : text)
-        encoded += huffmanCode[c];
+    if (compared == 0)
+        throw std::runtime_error("Benchmark baseline has no measured phases.");
 
-    return encoded;
-}
+    auto slow = slower(results, expected, threshold);
+    for (unsigned retry = 0; retry < kGateRetries && !slow.empty(); ++retry)
+    {
+        std::vector<std::pair<std::string, std::size_t>> sets;
+        for (const auto& phase : slow)
+        {
+            const std::pair<std::string, std::size_t> set(phase.first.corpus, phase.first.size);
+            if (std::find(sets.begin(), sets.end(), set) == sets.end())
+                sets.push_back(set);
+        }
 
+        std::ostringstream discard;
+        for (const auto& set : sets)
+        {
+            std::vector<Result> again;
+            measure(set.first, Corpus::generate(set.first, set.second), discard, again);
+            for (const auto& fresh : again)
+                for (auto& result : results)
+                    if (result.corpus == fresh.corpus && result.size == fresh.size && result.phase == fresh.phase)
+                        result.mbPerSecond = std::max(result.mbPerSecond, fresh.mbPerSecond);
+        }
+
+        slow = slower(results, expected, threshold);
+    }
+
+    for (const auto& phase : slow)
+    {
+        const auto& result = phase.first;
+        log << "regression: " << result.corpus << ' ' << result.size << ' ' << result.phase << ": "
+            << result.mbPerSecond << " MB/s, baseline " << phase.second << " MB/s ("
+            << (result.mbPerSecond / phase.second - 1) * 100 << "%)\n";
+    }
+
+    log << slow.size() << " of " << compared << " phases slower than baseline by more than " << threshold * 100 << "%\n";
+
+    return slow.empty();
+}
 
 /**
- * @brief Декодировать текст с помощью дерева Хаффмана
- * @param text Закодированный текст
- * @return std::string Декодированный текст
+ * @brief Прочитать сохраненный вывод run
+ * @param is Поток с результатами
+ * @return std::vector<Benchmark::Result> Скорости фаз
+ * @throw std::runtime_error Если строка не разбирается
  */
-std::string Huffman::decode(const std::string& text)
+std::vector<Benchmark::Result> Benchmark::readResults(std::istream& is)
 {
-    // В начале должен быть заголовок с частотами
-    if (text.substr(0, 3) != "het" || !std::isspace(text[3]))
-        throw std::runtime_error("Can not decode not encoded text.");
+    std::vector<Result> results;
 
-    // Читаем частоты в карту
-    std::map<char, std::size_t> freq;
-    std::size_t i = 4;
-    while (true)
+    std::string line;
+    std::getline(is, line);
+    while (std::getline(is, line))
     {
-        char c = text[i];
-        // Если дошли до конца - выходим
-        if (c == 'h' && i + 2 < text.size() && text[i + 1] == 'e' && text[i + 2] == 't')
+        if (line.empty())
+            continue;
+
+        std::vector<std::string> fields;
+        for (std::size_t begin = 0, end; begin <= line.size(); begin = end + 1)
         {
-            i += 4;
-            break;
+            end = std::min(line.find('\t', begin), line.size());
+            fields.push_back(line.substr(begin, end - begin));
         }
 
-        if (!std::isspace(text[i + 1]))
-            throw std::runtime_error(std::string("Invalid encoded symbol: expected space after '") + c + "'.");
+        if (fields.size() < 4)
+            throw std::runtime_error("Invalid benchmark baseline line: " + line);
 
-        i += 2;
-        if (i >= text.size())
-            throw std::runtime_error("Invalid encoded symbol.");
+        results.push_back(Result{ fields[0], static_cast<std::size_t>(std::stoull(fields[1])), fields[2], std::stod(fields[3]) });
+    }
 
-        char* e;
-        freq[c] = std::strtoull(text.data() + i, &e, 10);
+    return results;
+}
 
-        i = e - text.data() + 1;
+/**
+ * @brief Найти фазы, ставшие медленнее эталона больше чем на threshold
+ * @param results Замер
+ * @param baseline Эталон
+ * @param threshold Допустимое замедление, доля от эталонной скорости
+ * @return std::vector<std::pair<Benchmark::Result, double>> Медленные фазы и их эталонная скорость
+ */
+std::vector<std::pair<Benchmark::Result, double>> Benchmark::slower(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold)
+{
+    std::vector<std::pair<Result, double>> slow;
+    for (const auto& result : results)
+        for (const auto& base : baseline)
+            if (result.corpus == base.corpus && result.size == base.size && result.phase == base.phase && result.mbPerSecond < base.mbPerSecond * (1 - threshold))
+                slow.emplace_back(result, base.mbPerSecond);
+
+    return slow;
+}
+
+/**
+ * @brief Замерить все фазы на одном наборе данных
+ * histogram, tree, codes, emit - фазы кодирования всех блоков по отдельности,
+ * encode, decode - кодирование и декодирование целиком в одном потоке
+ * @param corpus Имя набора
+ * @param data Набор данных
+ * @param os Поток для результатов
+ * @param results Сюда добавляются скорости фаз
+ * @throw std::runtime_error Если декодированный текст не совпал с исходным
+ */
+void Benchmark::measure(const std::string& corpus, const std::string& data, std::ostream& os, std::vector<Result>& results)
+{
+    std::vector<std::string_view> blocks;
+    for (std::size_t offset = 0; offset < data.size(); offset += Huffman::kBlockSize)
+        blocks.push_back(std::string_view(data).substr(offset, Huffman::kBlockSize));
+
+    const Huffman::Settings settings;
+    std::vector<Huffman::BlockHistograms> histograms(blocks.size());
+    std::vector<Huffman::Tree> trees(blocks.size());
+    std::vector<Huffman::CodeTable> codes(blocks.size());
+    std::vector<std::string> bodies(blocks.size());
+    std::string encoded;
+    std::string decoded;
+
+    // Фаза, ее время и прирост RSS за все ее повторы
+    std::vector<std::tuple<const char*, double, std::int64_t>> phases;
+    const auto phase = [&](const char* name, auto&& function)
+    {
+        const auto before = residentKb();
+        const auto seconds = time(function);
+        phases.emplace_back(name, seconds, residentKb() - before);
+    };
+    phase("histogram", [&] { for (std::size_t b = 0; b < blocks.size(); ++b) histograms[b] = Huffman::countBlock(blocks[b], settings); });
+    phase("tree", [&] { for (std::size_t b = 0; b < blocks.size(); ++b) trees[b] = Huffman::generateHuffmanTree(histograms[b].total); });
+    phase("codes", [&] { for (std::size_t b = 0; b < blocks.size(); ++b) codes[b] = Huffman::generateHuffmanCodes(trees[b], settings.maxCodeLength); });
+    phase("emit", [&] { for (std::size_t b = 0; b < blocks.size(); ++b) Huffman::emitBlock(blocks[b], histograms[b], codes[b], false, bodies[b]); });
+    phase("encode", [&] { encoded = Huffman::encode(data); });
+    phase("decode", [&] { decoded = Huffman::decode(encoded); });
+
+    if (decoded != data)
+        throw std::runtime_error("Benchmark round trip failed on " + corpus + ".");
+
+    const double size = static_cast<double>(std::max<std::size_t>(data.size(), 1));
+    const double ratio = static_cast<double>(encoded.size()) / size;
+    for (const auto& [name, seconds, rssDelta] : phases)
+    {
+        os << corpus << '\t' << data.size() << '\t' << name << '\t'
+           << size / seconds / 1e6 << '\t' << seconds * 1e9 / size << '\t'
+           << ratio << '\t' << rssDelta << '\n';
+
+        results.push_back(Result{ corpus, data.size(), name, size / seconds / 1e6 });
     }
+}
 
-    auto root = generateHuffmanTree(freq);
+/**
+ * @brief Время одного выполнения функции: лучшее из нескольких повторов
+ * @param function Замеряемая функция
+ * @return double Время в секундах
+ */
+template <typename Function>
+double Benchmark::time(Function&& function)
+{
+    using Clock = std::chrono::steady_clock;
 
-    const auto huffmanCode = generateHuffmanCodes(root);
+    double best = 0;
+    double total = 0;
+    for (unsigned run = 0; run < kMinRuns || total < kMinSeconds; ++run)
+    {
+        const auto start = Clock::now();
+        function();
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
 
-    // Разворачиваем карту кодов (меняем местами ключ и значение)
-    std::map<std::string, char> reversedHuffmanCode;
-    for (const auto& c : huffmanCode)
-        reversedHuffmanCode[c.second] = c.first;
+        best = run == 0 ? elapsed : std::min(best, elapsed);
+        total += elapsed;
+    }
+
+    return std::max(best, 1e-9);
+}
+
+/**
+ * @brief Текущий размер резидентной памяти процесса
+ * Не пик (ru_maxrss только растет и за фазу ничего не говорит), а текущее значение
+ * из /proc/self/statm, поэтому разность до и после фазы - ее собственный прирост
+ * @return std::int64_t RSS в килобайтах, 0 - если неизвестен
+ */
+std::int64_t Benchmark::residentKb()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    std::int64_t pages = 0;
+    std::int64_t resident = 0;
+    if (statm >> pages >> resident)
+        return resident * static_cast<std::int64_t>(::sysconf(_SC_PAGESIZE)) / 1024;
+#endif
+
+    return 0;
+}
 
-    std::string decode;
-    while (i < text.size())
+/**
+ * @brief Входной файл, по возможности отображенный в память только для чтения
+ * Содержимое отображенного файла отдается прямо из страничного кэша, без копирования.
+ * Если отобразить файл нельзя (канал, стандартный ввод, нет mmap) - он читается порциями
+ * в собственный буфер, так что и такой вход может быть больше памяти
+ */
+class InputFile
+{
+public:
+    explicit InputFile(const std::string& filename);
+    ~InputFile();
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    std::string_view read(std::size_t size);
+    std::string_view read(std::size_t size, std::string& buffer);
+    std::string_view view();
+
+private:
+    std::string m_filename;
+    std::string_view m_mapped;
+    std::size_t m_pos = 0;
+    std::string m_buffer;
+#ifdef HUFFMAN_POSIX_IO
+    int m_fd = -1;
+#else
+    std::ifstream m_ifs;
+    std::istream* m_stream = &m_ifs;
+#endif
+};
+
+/**
+ * @brief Открыть файл и по возможности отобразить его в память
+ * @param filename Имя файла, "-" - стандартный ввод
+ * @throw std::runtime_error Если не удалось открыть файл с заданным именем
+ */
+InputFile::InputFile(const std::string& filename)
+    : m_filename(filename)
+{
+#ifdef HUFFMAN_POSIX_IO
+    m_fd = filename == "-" ? STDIN_FILENO : ::open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        throw std::runtime_error("Can not open \"" + filename + "\"");
+
+    struct stat st;
+    if (::fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
     {
-        // Пока не найдем соответсвие в reversedHuffmanCode набираем по символу.
-        //Нашли - вставляем и по новой пока текст не кончится
-        std::size_t j = i + 1;
-        while (j <= text.size())
+        void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (data != MAP_FAILED)
         {
-            auto it = reversedHuffmanCode.find(text.substr(i, j - i));
-            if (it != reversedHuffmanCode.end())
-            {
-                decode += it->second;
-                break;
-            }
-            ++j;
+            // Файл читается от начала к концу - просим ядро читать вперед побольше
+            ::madvise(data, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+            m_mapped = std::string_view(static_cast<const char*>(data), static_cast<std::size_t>(st.st_size));
         }
-        i = j;
     }
+#else
+    if (filename == "-")
+    {
+        m_stream = &std::cin;
+    }
+    else
+    {
+        m_ifs.open(filename, std::ios::binary);
+        if (!m_ifs.is_open())
+            throw std::runtime_error("Can not open \"" + filename + "\"");
+    }
+#endif
+}
+
+InputFile::~InputFile()
+{
+#ifdef HUFFMAN_POSIX_IO
+    if (!m_mapped.empty())
+        ::munmap(const_cast<char*>(m_mapped.data()), m_mapped.size());
 
-    return decode;
+    if (m_fd > STDIN_FILENO)
+        ::close(m_fd);
+#endif
 }
 
 /**
- * @brief Создать дерево Хаффмана
- * @param freq Карта частот символов
- * @return Huffman::Node::Ptr Корень дерева Хаффмана
+ * @brief Прочитать следующую порцию
+ * Порция из буфера действительна до следующего вызова read или view
+ * @param size Наибольший размер порции
+ * @return std::string_view Порция, пустая - файл кончился
+ * @throw std::runtime_error Если чтение не удалось
  */
-Huffman::Node::Ptr Huffman::generateHuffmanTree(const std::map<char, std::size_t>& freq)
+std::string_view InputFile::read(std::size_t size)
 {
-    // Конвертируем карту частот в очередь с приоритетом
-    PriorityQueue pq;
+    return read(size, m_buffer);
+}
+
+/**
+ * @brief Прочитать следующую порцию в буфер вызывающего
+ * Порция отображенного файла не копируется и действительна, пока жив InputFile,
+ * остальные читаются в buffer и действительны, пока он не изменится
+ * @param size Наибольший размер порции
+ * @param buffer Буфер под порцию
+ * @return std::string_view Порция, пустая - файл кончился
+ * @throw std::runtime_error Если чтение не удалось
+ */
+std::string_view InputFile::read(std::size_t size, std::string& buffer)
+{
+    if (!m_mapped.empty())
     {
-        for (const auto& f : freq)
-            pq.push(Node::Ptr(new Node{ f.first, f.second, nullptr, nullptr }));
+        const auto chunk = m_mapped.substr(m_pos, size);
+        m_pos += chunk.size();
+
+        return chunk;
     }
 
-    // Берем два верхних элемента и создаем новый
-    // С '\0' символом, частотой равной сумме частот взятых
-    // И так пока в очереди не остается лишь один элемент - корень
-    while (pq.size() > 1)
+    buffer.resize(size);
+    std::size_t got = 0;
+#ifdef HUFFMAN_POSIX_IO
+    while (got < size)
     {
-        auto left = pq.top();
-        pq.pop();
+        const auto n = ::read(m_fd, &buffer[got], size - got);
+        if (n < 0 && errno == EINTR)
+            continue;
 
-        auto right = pq.top();
-        pq.pop();
+        if (n < 0)
+            throw std::runtime_error("Can not read \"" + m_filename + "\"");
 
-        pq.push(Node::Ptr(new Node{ '\0', left->freq + right->freq, left, right }));
+        if (n == 0)
+            break;
+
+        got += static_cast<std::size_t>(n);
     }
+#else
+    m_stream->read(&buffer[0], static_cast<std::streamsize>(size));
+    got = static_cast<std::size_t>(m_stream->gcount());
+    if (m_stream->bad())
+        throw std::runtime_error("Can not read \"" + m_filename + "\"");
+#endif
+
+    buffer.resize(got);
 
-    return pq.top();
+    return buffer;
 }
 
 /**
- * @brief Создать карту замен исходных символов на закодированные
- * @param root Корень дерева Хаффмана
- * @return std::map<char, std::string> Карта замен исходных символов на закодированные
+ * @brief Получить все оставшееся содержимое файла
+ * Отображенный файл не копируется, остальные дочитываются в буфер целиком
+ * @return std::string_view Содержимое файла
+ * @throw std::runtime_error Если чтение не удалось
  */
-std::map<char, std::string> Huffman::generateHuffmanCodes(const Node::Ptr& root)
+std::string_view InputFile::view()
 {
-    std::map<char, std::string> huffmanCode;
-    generateHuffmanCodesImpl(root, "", huffmanCode);
+    if (!m_mapped.empty())
+    {
+        const auto rest = m_mapped.substr(m_pos);
+        m_pos = m_mapped.size();
+
+        return rest;
+    }
 
-    return huffmanCode;
+    std::string content;
+    for (auto chunk = read(std::size_t(1) << 20); !chunk.empty(); chunk = read(std::size_t(1) << 20))
+        content.append(chunk.data(), chunk.size());
+
+    m_buffer = std::move(content);
+
+    return m_buffer;
 }
 
 /**
- * @brief Создать карту замен исходных символов на закодированные
- * @param root Корень дерева Хаффмана
- * @param repr Текущий код для символа
- * @param huffmanCode Карта замен исходных символов на закодированные
+ * @brief Запись в файл крупными кусками
+ * Мелкие куски копятся в буфере и уходят в файл ровно по kBufferSize байт,
+ * крупные пишутся напрямую, минуя буфер
+ */
+class FileWriter
+{
+public:
+    explicit FileWriter(const std::string& filename);
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    void write(std::string_view data);
+    void close();
+    void discard();
+
+private:
+    void writeRaw(const char* data, std::size_t size);
+
+    static constexpr std::size_t kBufferSize = std::size_t(1) << 22;
+
+    std::string m_filename;
+    std::string m_buffer;
+#ifdef HUFFMAN_POSIX_IO
+    int m_fd = -1;
+#else
+    std::ofstream m_ofs;
+    std::ostream* m_stream = &m_ofs;
+#endif
+};
+
+/**
+ * @brief Открыть файл на запись (существующий файл обрезается)
+ * @param filename Имя файла, "-" - стандартный вывод
+ * @throw std::runtime_error Если не удалось открыть файл с заданным именем
  */
-void Huffman::generateHuffmanCodesImpl(const Node::Ptr& root, const std::string& repr, std::map<char, std::string>& huffmanCode)
+FileWriter::FileWriter(const std::string& filename)
+    : m_filename(filename)
 {
-    // Рекурсивно проходимся по дереву и генерируем строку-замену для очередного символа
-    // Если мы пошли влево - то к следующему коду приписываем '0', иначе '1'.
-    // Когда у ноды нет потомков - записываем полученный код в карту замен
-    if (root)
+#ifdef HUFFMAN_POSIX_IO
+    m_fd = filename == "-" ? STDOUT_FILENO : ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+        throw std::runtime_error("Can not open \"" + filename + "\"");
+#else
+    if (filename == "-")
+    {
+        m_stream = &std::cout;
+    }
+    else
     {
-        if (!root->left && !root->right)
-            huffmanCode[root->value] = repr;
+        m_ofs.open(filename, std::ios::binary);
+        if (!m_ofs.is_open())
+            throw std::runtime_error("Can not open \"" + filename + "\"");
+    }
+#endif
+
+    m_buffer.reserve(kBufferSize);
+}
+
+FileWriter::~FileWriter()
+{
+    // Ошибку записи из деструктора не выбросить - кто хочет ее узнать, зовет close()
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+/**
+ * @brief Записать данные
+ * @param data Данные
+ * @throw std::runtime_error Если запись не удалась
+ */
+void FileWriter::write(std::string_view data)
+{
+    if (!m_buffer.empty())
+    {
+        const auto take = std::min(data.size(), kBufferSize - m_buffer.size());
+        m_buffer.append(data.data(), take);
+        data.remove_prefix(take);
+
+        if (m_buffer.size() < kBufferSize)
+            return;
+
+        writeRaw(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+    const auto direct = data.size() - data.size() % kBufferSize;
+    writeRaw(data.data(), direct);
+    m_buffer.append(data.data() + direct, data.size() - direct);
+}
+
+/**
+ * @brief Дописать буфер и закрыть файл
+ * @throw std::runtime_error Если запись не удалась
+ */
+void FileWriter::close()
+{
+#ifdef HUFFMAN_POSIX_IO
+    if (m_fd < 0)
+        return;
 
-        generateHuffmanCodesImpl(root->left, repr + '0', huffmanCode);
-        generateHuffmanCodesImpl(root->right, repr + '1', huffmanCode);
+    const auto fd = m_fd;
+    try
+    {
+        writeRaw(m_buffer.data(), m_buffer.size());
     }
+    catch (...)
+    {
+        ::close(fd);
+        m_fd = -1;
+        throw;
+    }
+
+    m_fd = -1;
+    if (fd != STDOUT_FILENO && ::close(fd) != 0)
+        throw std::runtime_error("Can not write \"" + m_filename + "\"");
+#else
+    if (!m_stream)
+        return;
+
+    writeRaw(m_buffer.data(), m_buffer.size());
+    m_stream->flush();
+    if (m_ofs.is_open())
+        m_ofs.close();
+
+    m_stream = nullptr;
+#endif
+
+    m_buffer.clear();
 }
 
 /**
- * @brief Получить карту частот символов в тексте
- * @param text входной текст
- * @return std::map<char, std::size_t> карта частот символов в тексте
+ * @brief Бросить недописанный файл: буфер не пишется, файл закрывается и удаляется
+ * Стандартный вывод не удалить, в него просто больше ничего не пишется
  */
-std::map<char, std::size_t> Huffman::getFreq(const std::string& text)
+void FileWriter::discard()
 {
-    std::map<char, std::size_t> freq;
-    for (const auto& c : text)
-        ++freq[c];
+    m_buffer.clear();
+#ifdef HUFFMAN_POSIX_IO
+    if (m_fd > STDOUT_FILENO)
+        ::close(m_fd);
 
-    return freq;
+    m_fd = -1;
+#else
+    if (m_ofs.is_open())
+        m_ofs.close();
+
+    m_stream = nullptr;
+#endif
+
+    if (m_filename != "-")
+        std::remove(m_filename.c_str());
+}
+
+/**
+ * @brief Записать данные в файл мимо буфера
+ * @param data Данные
+ * @param size Размер данных
+ * @throw std::runtime_error Если запись не удалась
+ */
+void FileWriter::writeRaw(const char* data, std::size_t size)
+{
+#ifdef HUFFMAN_POSIX_IO
+    while (size > 0)
+    {
+        // Сигнал и неполная запись в канал или сокет - не ошибка, дописываем остаток
+        const auto n = ::write(m_fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0)
+            throw std::runtime_error("Can not write \"" + m_filename + "\"");
+
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+#else
+    if (!m_stream->write(data, static_cast<std::streamsize>(size)))
+        throw std::runtime_error("Can not write \"" + m_filename + "\"");
+#endif
 }
 
 /**
  * @brief Прочитать весь файл
+ * Файл отображается в память, содержимое берется через InputFile::view() без копирования
  * @param filename Имя файла
- * @return std::string Содержимое файла
+ * @return InputFile Содержимое файла
  * @throw std::runtime_error Если не удалось открыть файл с заданным именем
  */
-std::string readFile(const std::string& filename)
+InputFile readFile(const std::string& filename)
 {
-    std::ifstream ifs(filename);
-    if (!ifs.is_open())
-        throw std::runtime_error("Can not open \"" + filename + "\"");
-
-    std::stringstream ss;
-    ss << ifs.rdbuf();
-
-    return ss.str();
+    return InputFile(filename);
 }
 
 /**
  * @brief Написать в файл
  * @param filename Имя файла
  * @param text Текст для записи
- * @throw std::runtime_error Если не удалось открыть файл с заданным именем
+ * @throw std::runtime_error Если не удалось открыть файл с заданным именем или записать в него
  */
-void writeFile(const std::string& filename, const std::string& text)
+void writeFile(const std::string& filename, std::string_view text)
 {
-    std::ofstream ofs(filename);
-    if (!ofs.is_open())
-        throw std::runtime_error("Can not open \"" + filename + "\"");
+    FileWriter writer(filename);
+    writer.write(text);
+    writer.close();
+}
+
+/**
+ * @brief Буферы конвейера transformFile, переиспользуются между файлами
+ */
+struct PipelineBuffers
+{
+    // Сколько порций одновременно бывает в пути между соседними стадиями
+    static constexpr std::size_t kDepth = 3;
+
+    std::array<std::string, kDepth> inputs;
+    std::array<std::string, kDepth> outputs;
+};
+
+/**
+ * @brief Пройти по страницам порции отображенного файла
+ * Тогда страницы подгружаются с диска в потоке чтения, а не посреди кодирования
+ * @param data Порция
+ */
+void touchPages(std::string_view data)
+{
+    constexpr std::size_t kPageSize = 4096;
+
+    volatile char sink = 0;
+    for (std::size_t i = 0; i < data.size(); i += kPageSize)
+        sink = data[i];
+
+    static_cast<void>(sink);
+}
+
+/**
+ * @brief Прогнать файл через потоковый кодировщик или декодировщик
+ * Вход подается кодировщику порциями по chunkSize байт (у отображенного файла - прямо
+ * из страничного кэша), выход каждой порции сразу уходит в файл.
+ * Поэтому файл может быть больше памяти.
+ * Чтение, кодирование и запись - три стадии конвейера в своих потоках: пока кодировщик
+ * (со своим пулом) занят порцией, следующая уже читается, а предыдущая пишется.
+ * Между стадиями по кругу ходят PipelineBuffers::kDepth буферов входа и выхода,
+ * порядок порций сохраняется, потому что каждая стадия одна
+ * @param input Имя входного файла, "-" - стандартный ввод
+ * @param output Имя выходного файла, "-" - стандартный вывод
+ * @param coder Huffman::Encoder или Huffman::Decoder
+ * @param chunkSize Размер порции
+ * @param buffers Буферы под порции
+ * Если какая-то стадия сломалась, недописанный выходной файл удаляется
+ * @throw std::runtime_error Если не удалось открыть файл с заданным именем, прочитать, декодировать или записать его
+ */
+template <typename Coder>
+void transformFile(const std::string& input, const std::string& output, Coder& coder, std::size_t chunkSize, PipelineBuffers& buffers)
+{
+    struct Chunk
+    {
+        std::string* buffer = nullptr;
+        std::string_view data;
+    };
+
+    InputFile file(input);
+    FileWriter writer(output);
+
+    constexpr auto kDepth = PipelineBuffers::kDepth;
+    BoundedQueue<std::string*> freeInputs(kDepth);
+    BoundedQueue<Chunk> readChunks(kDepth);
+    BoundedQueue<std::string*> freeOutputs(kDepth);
+    BoundedQueue<std::string*> codedChunks(kDepth);
+
+    for (std::size_t i = 0; i < kDepth; ++i)
+    {
+        freeInputs.push(&buffers.inputs[i]);
+        freeOutputs.push(&buffers.outputs[i]);
+    }
+
+    std::exception_ptr readError;
+    std::thread reader([&]
+    {
+        try
+        {
+            std::string* buffer = nullptr;
+            while (freeInputs.pop(buffer))
+            {
+                const auto data = file.read(chunkSize, *buffer);
+                if (data.empty())
+                    break;
+
+                if (data.data() != buffer->data())
+                    touchPages(data);
+
+                readChunks.push({ buffer, data });
+            }
+        }
+        catch (...)
+        {
+            readError = std::current_exception();
+        }
+
+        readChunks.close();
+    });
+
+    // Выставляется до codedChunks.close(), если чтение или кодирование сломалось:
+    // тогда недописанный выход не закрывается как готовый, а удаляется
+    std::atomic<bool> aborted{ false };
+    std::exception_ptr writeError;
+    std::thread writing([&]
+    {
+        try
+        {
+            std::string* buffer = nullptr;
+            while (codedChunks.pop(buffer))
+            {
+                writer.write(*buffer);
+                freeOutputs.push(buffer);
+            }
+
+            if (!aborted)
+                writer.close();
+        }
+        catch (...)
+        {
+            writeError = std::current_exception();
+        }
+
+        // Кодировщик не должен ждать буфер, который уже никто не вернет
+        freeOutputs.close();
+    });
+
+    // Кодирование - в вызывающем потоке. Выходит без finish, если другая стадия сломалась
+    const auto code = [&]
+    {
+        Chunk chunk;
+        std::string* out = nullptr;
+        while (readChunks.pop(chunk))
+        {
+            if (!freeOutputs.pop(out))
+                return;
+
+            out->clear();
+            coder.update(chunk.data, *out);
+            freeInputs.push(chunk.buffer);
+            codedChunks.push(out);
+        }
+
+        if (readError || !freeOutputs.pop(out))
+            return;
+
+        out->clear();
+        coder.finish(*out);
+        codedChunks.push(out);
+    };
 
-    ofs << text;
+    std::exception_ptr codeError;
+    try
+    {
+        code();
+    }
+    catch (...)
+    {
+        codeError = std::current_exception();
+    }
+
+    // Ошибка чтения видна здесь: reader выставил ее до readChunks.close(), а code дождался закрытия
+    aborted = codeError || readError;
+    freeInputs.close();
+    codedChunks.close();
+    reader.join();
+    writing.join();
+
+    for (const auto& error : { codeError, readError, writeError })
+    {
+        if (error)
+        {
+            writer.discard();
+            std::rethrow_exception(error);
+        }
+    }
 }
 
-int main()
+// Расширение закодированных файлов в пакетном режиме
+const std::string kEncodedSuffix = ".het";
+
+const char* const kUsage =
+    "Usage: huffman [-c | -d] [-o output] [-j threads] [-l bits] [-s streams] [-m order] [-w width] [-x] [-a] [-k] [--stats] [file ...]\n"
+    "       huffman -r offset:length [-o output] [-j threads] file ...\n"
+    "       huffman --train -o dictionary [-i id] [-l bits] sample ...\n"
+    "       huffman --bench [--baseline file] [--threshold percent] [size ...]\n"
+    "  -c          encode (default)\n"
+    "  -d          decode\n"
+    "  -o output   write to output instead of file.het / file without .het, \"-\" - stdout\n"
+    "  -j threads  number of threads (default: all cores)\n"
+    "  -l bits     maximum code length, 8..32 (default: 11)\n"
+    "  -s streams  bit streams per block, 1 or 4 (default: 4)\n"
+    "  -m order    model order: 0, or 1 for code tables chosen by the previous byte (default: 0)\n"
+    "  -w width    symbol width in bytes: 1, or 2 to also try codes for byte pairs (default: 1)\n"
+    "  -x          write a seek index, so -r finds blocks without walking the whole file\n"
+    "  -a          approximate model: order-0 codes from a 1/16 sample of each block, one pass over it\n"
+    "  -k          store a CRC32C of each block, checked when decoding\n"
+    "  -r range    decode only bytes [offset, offset + length) of each file\n"
+    "  -D file     encode/decode each file as one short message with a trained dictionary;\n"
+    "              repeat to decode with the dictionary whose id the message names, encode uses the first\n"
+    "  --train     train a dictionary on the samples, -i sets its id (default: 1)\n"
+    "  --stats     print counters to stderr (needs a build with -DHUFFMAN_STATS=1)\n"
+    "  file        input files, \"-\" or none - stdin to stdout\n"
+    "  --bench     measure speed on generated data of the given sizes (K, M suffixes)\n"
+    "  --baseline  saved --bench output: fail if a phase in it got slower by more than\n"
+    "              --threshold percent (default: 10)\n"
+    "Without arguments runs interactively.\n";
+
+/**
+ * @brief Параметры командной строки
+ */
+struct Options
+{
+    bool decode = false;
+    std::string output;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    Huffman::Settings settings;
+    bool train = false;
+    bool stats = false;
+    std::uint32_t dictionaryId = 1;
+    std::vector<std::string> dictionaries;
+    bool range = false;
+    std::uint64_t rangeOffset = 0;
+    std::size_t rangeLength = 0;
+    std::vector<std::string> inputs;
+};
+
+/**
+ * @brief Разобрать аргументы командной строки
+ * @param argc Количество аргументов
+ * @param argv Аргументы
+ * @return Options Параметры
+ * @throw std::runtime_error Если аргументы неверны
+ */
+Options parseOptions(int argc, char* argv[])
+{
+    Options options;
+
+    bool onlyFiles = false;
+    for (int a = 1; a < argc; ++a)
+    {
+        const std::string arg = argv[a];
+        const auto value = [&]() -> std::string
+        {
+            if (a + 1 >= argc)
+                throw std::runtime_error("Missing value for " + arg + ".");
+
+            return argv[++a];
+        };
+
+        if (onlyFiles || arg == "-" || arg.empty() || arg[0] != '-')
+            options.inputs.push_back(arg);
+        else if (arg == "--")
+            onlyFiles = true;
+        else if (arg == "-c")
+            options.decode = false;
+        else if (arg == "-d")
+            options.decode = true;
+        else if (arg == "-o")
+            options.output = value();
+        else if (arg == "-D")
+            options.dictionaries.push_back(value());
+        else if (arg == "-i")
+            options.dictionaryId = static_cast<std::uint32_t>(std::stoul(value()));
+        else if (arg == "--train")
+            options.train = true;
+        else if (arg == "--stats")
+            options.stats = true;
+        else if (arg == "-j")
+            options.threads = std::max<std::size_t>(1, std::stoul(value()));
+        else if (arg == "-l")
+            options.settings.maxCodeLength = static_cast<unsigned>(std::stoul(value()));
+        else if (arg == "-s")
+        {
+            const auto streams = value();
+            if (streams != "1" && streams != "4")
+                throw std::runtime_error("Invalid number of streams " + streams + ".");
+
+            options.settings.interleaved = streams == "4";
+        }
+        else if (arg == "-m")
+        {
+            const auto order = value();
+            if (order != "0" && order != "1")
+                throw std::runtime_error("Invalid model order " + order + ".");
+
+            options.settings.order = order == "1" ? 1 : 0;
+        }
+        else if (arg == "-w")
+        {
+            const auto width = value();
+            if (width != "1" && width != "2")
+                throw std::runtime_error("Invalid symbol width " + width + ".");
+
+            options.settings.symbolWidth = width == "2" ? 2 : 1;
+        }
+        else if (arg == "-x")
+            options.settings.seekIndex = true;
+        else if (arg == "-a")
+            options.settings.sampled = true;
+        else if (arg == "-k")
+            options.settings.checksum = true;
+        else if (arg == "-r")
+        {
+            const auto range = value();
+            const auto colon = range.find(':');
+            if (colon == std::string::npos)
+                throw std::runtime_error("Invalid range " + range + ".");
+
+            options.range = true;
+            options.decode = true;
+            options.rangeOffset = std::stoull(range.substr(0, colon));
+            options.rangeLength = static_cast<std::size_t>(std::stoull(range.substr(colon + 1)));
+        }
+        else
+            throw std::runtime_error("Unknown option " + arg + ".");
+    }
+
+    if (options.inputs.empty())
+        options.inputs.push_back("-");
+
+    if (options.train && options.output.empty())
+        throw std::runtime_error("--train needs -o.");
+
+    if (!options.train && !options.output.empty() && options.inputs.size() > 1)
+        throw std::runtime_error("-o can be used with a single input only.");
+
+    return options;
+}
+
+/**
+ * @brief Имя выходного файла для входного в пакетном режиме
+ * @param input Имя входного файла
+ * @param decode Декодирование или кодирование
+ * @return std::string Имя выходного файла
+ */
+std::string outputName(const std::string& input, bool decode)
+{
+    if (input == "-")
+        return "-";
+
+    if (!decode)
+        return input + kEncodedSuffix;
+
+    const auto suffix = input.size() - std::min(input.size(), kEncodedSuffix.size());
+    if (input.size() > kEncodedSuffix.size() && input.compare(suffix, std::string::npos, kEncodedSuffix) == 0)
+        return input.substr(0, suffix);
+
+    return input + ".out";
+}
+
+/**
+ * @brief Напечатать счетчики по строке "имя значение"
+ * @param stats Счетчики
+ * @param os Поток для вывода
+ */
+void printStats(const Huffman::Stats& stats, std::ostream& os)
+{
+    os << "bytes_in " << stats.bytesIn << '\n'
+       << "bytes_out " << stats.bytesOut << '\n'
+       << "blocks " << stats.blocks << '\n'
+       << "stored_blocks " << stats.storedBlocks << '\n'
+       << "reused_tables " << stats.reusedTables << '\n'
+       << "context_blocks " << stats.contextBlocks << '\n'
+       << "wide_blocks " << stats.wideBlocks << '\n'
+       << "sampled_blocks " << stats.sampledBlocks << '\n'
+       << "distinct_symbols " << stats.distinctSymbols() << '\n'
+       << "max_code_length " << stats.maxCodeLength << '\n'
+       << "avg_code_length " << stats.averageCodeLength() << '\n'
+       << "histogram_ns " << stats.histogramNs << '\n'
+       << "tree_ns " << stats.treeNs << '\n'
+       << "codes_ns " << stats.codesNs << '\n'
+       << "emit_ns " << stats.emitNs << '\n'
+       << "header_ns " << stats.headerNs << '\n'
+       << "decode_ns " << stats.decodeNs << '\n'
+       << "allocations " << stats.allocations << '\n';
+}
+
+/**
+ * @brief Обучить словарь на всех входных файлах и сохранить его в options.output
+ * @param options Параметры
+ */
+void train(const Options& options)
+{
+    std::array<std::uint64_t, 256> histogram{};
+    for (const auto& input : options.inputs)
+    {
+        InputFile file(input);
+        for (auto chunk = file.read(Huffman::kBlockSize); !chunk.empty(); chunk = file.read(Huffman::kBlockSize))
+            for (const auto& c : chunk)
+                ++histogram[static_cast<unsigned char>(c)];
+    }
+
+    const auto dictionary = Huffman::Dictionary::train(histogram, options.dictionaryId, options.settings.maxCodeLength);
+    writeFile(options.output, dictionary.serialize());
+}
+
+/**
+ * @brief Закодировать или декодировать каждый входной файл как одно сообщение по словарю
+ * Кодирует первый словарь, а декодирует тот, номер которого записан в сообщении
+ * @param options Параметры
+ * @throw std::runtime_error Если у двух словарей один номер или словаря из сообщения нет
+ */
+void runDictionary(const Options& options)
+{
+    std::vector<Huffman::Dictionary> dictionaries;
+    for (const auto& name : options.dictionaries)
+    {
+        auto file = readFile(name);
+        auto dictionary = Huffman::Dictionary::load(file.view());
+        for (const auto& loaded : dictionaries)
+            if (loaded.id() == dictionary.id())
+                throw std::runtime_error("Duplicate dictionary id " + std::to_string(dictionary.id()) + " in " + name + ".");
+
+        dictionaries.push_back(std::move(dictionary));
+    }
+
+    for (const auto& input : options.inputs)
+    {
+        const auto output = options.output.empty() ? outputName(input, options.decode) : options.output;
+
+        auto file = readFile(input);
+        const auto message = file.view();
+        if (!options.decode)
+        {
+            writeFile(output, Huffman::encode(message, dictionaries.front()));
+            continue;
+        }
+
+        const auto id = Huffman::dictionaryId(message);
+        const auto dictionary = std::find_if(dictionaries.begin(), dictionaries.end(), [&](const auto& d) { return d.id() == id; });
+        if (dictionary == dictionaries.end())
+            throw std::runtime_error("No dictionary with id " + std::to_string(id) + " for " + input + ".");
+
+        writeFile(output, Huffman::decode(message, *dictionary));
+    }
+}
+
+/**
+ * @brief Декодировать из каждого входного файла только часть текста
+ * Файл отображается в память, и читаются только заголовок, индекс и нужные блоки
+ * @param options Параметры
+ */
+void runRange(const Options& options)
+{
+    ThreadPool pool(options.threads);
+
+    for (const auto& input : options.inputs)
+    {
+        const auto output = options.output.empty() ? outputName(input, true) : options.output;
+
+        auto file = readFile(input);
+        writeFile(output, Huffman::decodeRange(file.view(), options.rangeOffset, options.rangeLength, &pool));
+    }
+}
+
+/**
+ * @brief Закодировать или декодировать все файлы из параметров
+ * Пул потоков, кодировщик и буферы одни на все файлы
+ * @param options Параметры
+ */
+void run(const Options& options)
+{
+    if (options.train)
+    {
+        train(options);
+        return;
+    }
+
+    if (!options.dictionaries.empty())
+    {
+        runDictionary(options);
+        return;
+    }
+
+    if (options.range)
+    {
+        runRange(options);
+        return;
+    }
+
+    // Блоки независимы, поэтому читаем сразу по блоку на каждый поток пула
+    ThreadPool pool(options.threads);
+    const auto chunkSize = Huffman::kBlockSize * pool.size();
+
+    Huffman::Encoder encoder(options.settings, &pool);
+    Huffman::Decoder decoder(&pool);
+    PipelineBuffers buffers;
+
+    Huffman::Stats stats;
+    if (options.stats)
+    {
+        if (!Huffman::statsEnabled())
+            throw std::runtime_error("--stats needs a build with -DHUFFMAN_STATS=1.");
+#if HUFFMAN_STATS
+        Huffman::setAllocationCounter(countAllocations);
+#endif
+
+        encoder.setStats(&stats);
+        decoder.setStats(&stats);
+    }
+
+    for (const auto& input : options.inputs)
+    {
+        const auto output = options.output.empty() ? outputName(input, options.decode) : options.output;
+        if (options.decode)
+            transformFile(input, output, decoder, chunkSize, buffers);
+        else
+            transformFile(input, output, encoder, chunkSize, buffers);
+    }
+
+    if (options.stats)
+        printStats(stats, std::cerr);
+}
+
+/**
+ * @brief Разобрать размер с необязательным суффиксом K или M
+ * @param text Размер, например "64K"
+ * @return std::size_t Размер в байтах
+ * @throw std::runtime_error Если размер неверен
+ */
+std::size_t parseSize(const std::string& text)
+{
+    std::size_t end = 0;
+    const auto value = std::stoull(text, &end);
+    const auto suffix = text.substr(end);
+
+    if (suffix.empty())
+        return value;
+    if (suffix == "K" || suffix == "k")
+        return value << 10;
+    if (suffix == "M" || suffix == "m")
+        return value << 20;
+
+    throw std::runtime_error("Invalid size " + text + ".");
+}
+
+/**
+ * @brief Диалоговый режим: спросить действие и имя файла
+ */
+void interactive()
 {
     std::cout << "1 - encode, 2 - decode\n";
 
     char c;
     std::cin >> c;
-    if (c == '1')
-    {
-        std::string filename;
-        std::cout << "Filename: ";
-        std::cin >> filename;
+    if (c != '1' && c != '2')
+        throw std::runtime_error("Invalid usage.");
+
+    std::string filename;
+    std::cout << "Filename: ";
+    std::cin >> filename;
 
-        const auto input = readFile(filename);
+    Options options;
+    options.decode = c == '2';
+    options.output = options.decode ? "decoded.txt" : "encoded.txt";
+    options.inputs.push_back(filename);
 
-        const auto encoded = Huffman::encode(input);
+    run(options);
+}
 
-        writeFile("encoded.txt", encoded);
+int main(int argc, char* argv[])
+{
+    if (argc == 2 && (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0))
+    {
+        std::cout << kUsage;
+        return 0;
     }
-    else if (c == '2')
+
+    try
     {
-        std::string filename;
-        std::cout << "Filename: ";
-        std::cin >> filename;
+        if (argc == 1)
+        {
+            interactive();
+            return 0;
+        }
 
-        const auto encoded = readFile(filename);
+        if (std::strcmp(argv[1], "--bench") == 0)
+        {
+            std::vector<std::size_t> sizes;
+            std::string baseline;
+            double threshold = 10;
+            for (int a = 2; a < argc; ++a)
+            {
+                if (std::strcmp(argv[a], "--baseline") == 0 && a + 1 < argc)
+                    baseline = argv[++a];
+                else if (std::strcmp(argv[a], "--threshold") == 0 && a + 1 < argc)
+                    threshold = std::stod(argv[++a]);
+                else
+                    sizes.push_back(parseSize(argv[a]));
+            }
 
-        const auto decoded = Huffman::decode(encoded);
+            if (sizes.empty())
+                sizes = { std::size_t(4) << 10, std::size_t(64) << 10, std::size_t(1) << 20, std::size_t(16) << 20 };
 
-        writeFile("decoded.txt", decoded);
+            if (baseline.empty())
+            {
+                Benchmark::run(sizes, std::cout);
+                return 0;
+            }
+
+            std::ifstream file(baseline);
+            if (!file)
+                throw std::runtime_error("Can not open " + baseline + ".");
+
+            return Benchmark::gate(sizes, file, threshold / 100, std::cout, std::cerr) ? 0 : 1;
+        }
+
+        Options options;
+        try
+        {
+            options = parseOptions(argc, argv);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "huffman: " << e.what() << '\n' << kUsage;
+            return 1;
+        }
+
+        run(options);
     }
-    else
+    catch (const std::exception& e)
     {
-        throw std::runtime_error("Invalid usage.");
+        std::cerr << "huffman: " << e.what() << '\n';
+        return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
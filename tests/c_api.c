@@ -0,0 +1,131 @@
+/*
+ * Проверка C-интерфейса из программы на C: собирается только с huffman_c.h.
+ * Круговое кодирование, коды возврата, нехватка буфера с нужным размером в *written
+ * и превращение исключений библиотеки в HUFFMAN_ERROR с текстом ошибки
+ */
+
+#include "huffman_c.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+/* Отметить проверку, при несовпадении - напечатать, что не прошло */
+static void check(int ok, const char* what)
+{
+    if (ok)
+        return;
+
+    ++failures;
+    fprintf(stderr, "FAIL %s\n", what);
+}
+
+/* Закодировать и декодировать текст с текущими параметрами контекста */
+static void roundTrip(huffman_context* context, const char* text, size_t size, const char* name)
+{
+    const size_t capacity = huffman_max_encoded_size(context, size);
+    char* encoded = (char*)malloc(capacity);
+    char* decoded = (char*)malloc(size + 1);
+    size_t encodedSize = 0;
+    size_t decodedSize = 0;
+    uint64_t expected = 0;
+
+    if (!encoded || !decoded)
+    {
+        check(0, "malloc");
+        free(encoded);
+        free(decoded);
+        return;
+    }
+
+    if (huffman_encode(context, text, size, encoded, capacity, &encodedSize) != HUFFMAN_OK)
+    {
+        fprintf(stderr, "FAIL encode %s: %s\n", name, huffman_last_error(context));
+        ++failures;
+    }
+    else
+    {
+        check(huffman_last_error(context)[0] == '\0', "no error after successful encode");
+        check(huffman_decoded_size(encoded, encodedSize, &expected) == HUFFMAN_OK && expected == size, "decoded size");
+        check(huffman_decode(context, encoded, encodedSize, decoded, size + 1, &decodedSize) == HUFFMAN_OK, name);
+        check(decodedSize == size && memcmp(decoded, text, size) == 0, name);
+    }
+
+    free(encoded);
+    free(decoded);
+}
+
+int main(void)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog";
+    const size_t size = sizeof(text) - 1;
+    char encoded[256];
+    char decoded[256];
+    char damaged[256];
+    char small[4];
+    size_t encodedSize = 0;
+    size_t written = 0;
+    uint64_t expected = 0;
+    huffman_context* context = huffman_context_create();
+
+    if (!context)
+    {
+        fprintf(stderr, "FAIL huffman_context_create\n");
+        return 1;
+    }
+
+    roundTrip(context, text, size, "default settings");
+    roundTrip(context, "", 0, "empty text");
+
+    check(huffman_set_option(context, HUFFMAN_OPTION_INTERLEAVED, 0) == HUFFMAN_OK, "set interleaved");
+    check(huffman_set_option(context, HUFFMAN_OPTION_ORDER, 1) == HUFFMAN_OK, "set order");
+    check(huffman_set_option(context, HUFFMAN_OPTION_CHECKSUM, 1) == HUFFMAN_OK, "set checksum");
+    check(huffman_set_option(context, HUFFMAN_OPTION_BLOCK_SIZE, 16) == HUFFMAN_OK, "set block size");
+    check(huffman_set_option(context, HUFFMAN_OPTION_THREADS, 2) == HUFFMAN_OK, "set threads");
+    roundTrip(context, text, size, "changed settings");
+
+    /* Буфер мал: код HUFFMAN_BUFFER_TOO_SMALL и нужный размер в *written */
+    check(huffman_encode(context, text, size, encoded, sizeof(encoded), &encodedSize) == HUFFMAN_OK, "encode");
+    check(huffman_encode(context, text, size, small, sizeof(small), &written) == HUFFMAN_BUFFER_TOO_SMALL, "encode into small buffer");
+    check(written == encodedSize, "encode reports needed size");
+    check(huffman_decode(context, encoded, encodedSize, small, sizeof(small), &written) == HUFFMAN_BUFFER_TOO_SMALL, "decode into small buffer");
+    check(written == size, "decode reports needed size");
+    check(huffman_encode(context, "", 0, NULL, 0, &written) == HUFFMAN_BUFFER_TOO_SMALL, "encode empty text into no buffer");
+
+    /* Пустой поток версии 1 без длины в заголовке декодируется через буфер контекста, dst не нужен */
+    check(huffman_decode(context, "het\x01\x00", 5, NULL, 0, &written) == HUFFMAN_OK && written == 0, "decode empty text into no buffer");
+
+    /* Исключения библиотеки - HUFFMAN_ERROR и текст ошибки */
+    memcpy(damaged, encoded, encodedSize);
+    damaged[encodedSize - 2] ^= 0x55;
+    check(huffman_decode(context, damaged, encodedSize, decoded, sizeof(decoded), &written) == HUFFMAN_ERROR, "damaged stream");
+    check(huffman_decode(context, "het\x09", 4, decoded, sizeof(decoded), &written) == HUFFMAN_ERROR, "unsupported version");
+    check(huffman_last_error(context)[0] != '\0', "error text after failed decode");
+    check(huffman_decode(context, text, size, decoded, sizeof(decoded), &written) == HUFFMAN_ERROR, "not encoded text");
+    check(huffman_decoded_size(text, size, &expected) == HUFFMAN_ERROR, "decoded size of not encoded text");
+    check(huffman_decoded_size("het\x04\x05", 5, &expected) == HUFFMAN_ERROR, "decoded size of a newer format version");
+    check(huffman_decoded_size("het\x00\x05", 5, &expected) == HUFFMAN_ERROR, "decoded size of format version 0");
+
+    check(huffman_set_option(context, (huffman_option)99, 1) == HUFFMAN_ERROR, "unknown option");
+    check(strcmp(huffman_last_error(context), "Unknown option.") == 0, "unknown option error text");
+    check(huffman_set_option(context, HUFFMAN_OPTION_BLOCK_SIZE, -1) == HUFFMAN_ERROR, "negative option value");
+
+    /* Без контекста */
+    check(huffman_encode(NULL, text, size, encoded, sizeof(encoded), &written) == HUFFMAN_ERROR, "encode without context");
+    check(strcmp(huffman_last_error(NULL), "No context.") == 0, "error text without context");
+
+    huffman_context_destroy(context);
+    huffman_context_destroy(NULL);
+
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("c_api: all cases ok\n");
+
+    return 0;
+}
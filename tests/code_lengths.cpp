@@ -0,0 +1,183 @@
+#include "huffman.h"
+
+#include <array>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Проверка длин кодов из заголовка блока неравенством Крафта
+ * Потоки собираются вручную: один блок SingleStreamBlock с длинами SparseLengths.
+ * Полный код декодируется, переполненный, неполный и слишком длинный - отвергаются.
+ * Так же вручную собирается поток с индексом блоков, у которого записи не совпадают с блоками
+ */
+namespace
+{
+std::size_t failures = 0;
+
+/**
+ * @brief Собрать поток из одного блока с заданными длинами кодов и битовым потоком
+ * @param lengths Пары (символ, длина кода)
+ * @param count Длина текста блока
+ * @param bits Битовый поток
+ * @return std::string Закодированный поток
+ */
+std::string stream(const std::vector<std::pair<char, unsigned char>>& lengths, std::size_t count, const std::string& bits)
+{
+    std::string body;
+    body += '\0'; // SingleStreamBlock
+    body += '\0'; // SparseLengths
+    body += static_cast<char>(lengths.size());
+    for (const auto& length : lengths)
+    {
+        body += length.first;
+        body += static_cast<char>(length.second);
+    }
+    body += bits;
+
+    // Все числа здесь меньше 128, поэтому каждый varint - один байт
+    std::string text = "het";
+    text += static_cast<char>(Huffman::kFormatVersion);
+    text += static_cast<char>(count + 1);
+    text += '\0';
+    text += static_cast<char>(count);
+    text += static_cast<char>(body.size());
+    text += body;
+    text += '\0';
+
+    return text;
+}
+
+/**
+ * @brief Собрать поток "aaaaaa" с индексом блоков: блок с кодом a = 0 и блок с кодами предыдущего
+ * @param entries Записи индекса: длина текста блока, размер блока в байтах, на сколько блоков назад его коды
+ * @return std::string Закодированный поток
+ */
+std::string seekStream(const std::vector<std::array<unsigned char, 3>>& entries)
+{
+    // Флаг kSeekIndexFlag, блоки: SingleStreamBlock "aaa" и он же с kReuseTableFlag
+    std::string text = "het";
+    text += static_cast<char>(Huffman::kFormatVersion);
+    text += '\x07';
+    text += '\x01';
+    text += std::string("\x03\x06\x00\x00\x01" "a" "\x01\x00", 8);
+    text += std::string("\x03\x02\x80\x00", 4);
+    text += '\0';
+
+    std::string index;
+    index += static_cast<char>(entries.size());
+    for (const auto& entry : entries)
+        index.append(entry.begin(), entry.end());
+
+    text += index;
+    for (unsigned b = 0; b < 8; ++b)
+        text += static_cast<char>(b == 0 ? index.size() : 0);
+
+    return text;
+}
+
+/**
+ * @brief Проверить, что поток декодируется в ожидаемый текст
+ * @param name Название случая
+ * @param text Закодированный поток
+ * @param expected Ожидаемый текст
+ */
+void accepts(const char* name, const std::string& text, const std::string& expected)
+{
+    try
+    {
+        if (Huffman::decode(text) == expected)
+            return;
+
+        std::cerr << "FAIL " << name << ": wrong decoded text\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "FAIL " << name << ": " << e.what() << '\n';
+    }
+
+    ++failures;
+}
+
+/**
+ * @brief Проверить, что поток отвергается с std::runtime_error
+ * @param name Название случая
+ * @param text Закодированный поток
+ */
+void rejects(const char* name, const std::string& text)
+{
+    try
+    {
+        Huffman::decode(text);
+        std::cerr << "FAIL " << name << ": decoded\n";
+        ++failures;
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+/**
+ * @brief Проверить, что decodeRange отвергает поток с std::runtime_error
+ * @param name Название случая
+ * @param text Закодированный поток
+ * @param offset Начало диапазона
+ */
+void rejectsRange(const char* name, const std::string& text, std::uint64_t offset)
+{
+    try
+    {
+        Huffman::decodeRange(text, offset, 3);
+        std::cerr << "FAIL " << name << ": decoded\n";
+        ++failures;
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+}
+
+int main()
+{
+    // Коды a = 0, b = 10, c = 11: "abca" - биты 0 10 11 0
+    accepts("complete code", stream({ { 'a', 1 }, { 'b', 2 }, { 'c', 2 } }, 4, "\x58"), "abca");
+    accepts("single symbol of length 1", stream({ { 'a', 1 } }, 3, std::string(1, '\0')), "aaa");
+
+    rejects("over-subscribed code", stream({ { 'a', 1 }, { 'b', 1 }, { 'c', 1 } }, 4, "\x58"));
+    rejects("under-subscribed code", stream({ { 'a', 1 }, { 'b', 2 } }, 4, "\x58"));
+    rejects("single symbol of length 2", stream({ { 'a', 2 } }, 3, std::string(1, '\0')));
+    rejects("code longer than the limit", stream({ { 'a', 1 }, { 'b', 33 } }, 1, std::string(1, '\0')));
+
+    // Верный индекс: блоки по 3 символа размером 8 и 4 байта, второй берет коды первого
+    const auto indexed = seekStream({ { 3, 8, 0 }, { 3, 4, 1 } });
+    accepts("stream with seek index", indexed, "aaaaaa");
+    try
+    {
+        if (Huffman::decodeRange(indexed, 3, 3) != "aaa")
+        {
+            std::cerr << "FAIL range with seek index: wrong decoded text\n";
+            ++failures;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "FAIL range with seek index: " << e.what() << '\n';
+        ++failures;
+    }
+
+    // Суммы размеров сходятся, но вторая запись указывает на нулевой байт в теле первого блока,
+    // и третий блок берет коды оттуда
+    rejectsRange("seek index entry inside a block body", seekStream({ { 1, 2, 0 }, { 2, 6, 0 }, { 3, 4, 1 } }), 3);
+    rejectsRange("seek index entry with wrong size", seekStream({ { 3, 9, 0 }, { 3, 3, 1 } }), 3);
+    rejectsRange("seek index entry with wrong count", seekStream({ { 2, 8, 0 }, { 4, 4, 1 } }), 0);
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+
+    std::cout << "code_lengths: all cases ok\n";
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "huffman.h"
+
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Словари: обучение, сохранение, загрузка и кодирование сообщений загруженным словарем
+ * Загруженный словарь должен кодировать так же, как обученный, а поврежденный словарь
+ * (байт без кода, неполный или переполненный код, чужая метка, лишние байты) - отвергаться при загрузке
+ */
+namespace
+{
+std::size_t failures = 0;
+
+/**
+ * @brief Отметить проверку, при несовпадении - напечатать, что не прошло
+ * @param ok Результат проверки
+ * @param what Что проверялось
+ */
+void check(bool ok, const char* what)
+{
+    if (ok)
+        return;
+
+    ++failures;
+    std::cerr << "FAIL " << what << '\n';
+}
+
+/**
+ * @brief Проверить, что вызов отвергается с std::runtime_error
+ * @param what Что проверялось
+ * @param function Вызов
+ */
+template <typename Function>
+void rejects(const char* what, Function&& function)
+{
+    try
+    {
+        function();
+        check(false, what);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+/**
+ * @brief Собрать сохраненный словарь с длинами кодов SparseLengths
+ * @param lengths Пары (символ, длина кода)
+ * @return std::string Сохраненный словарь с номером 7
+ */
+std::string blob(const std::string& lengths)
+{
+    // Номер и количество пар меньше 128 - по одному байту
+    std::string data = "hed";
+    data += '\x07';
+    data += '\0'; // SparseLengths
+    data += static_cast<char>(lengths.size() / 2);
+    data += lengths;
+
+    return data;
+}
+
+/**
+ * @brief Собрать сохраненный словарь с длинами кодов ByteLengths: длина у каждого из 256 байтов
+ * @param lengths Длины кодов
+ * @return std::string Сохраненный словарь с номером 7
+ */
+std::string blob(const Huffman::CodeLengths& lengths)
+{
+    std::string data = "hed";
+    data += '\x07';
+    data += '\x02'; // ByteLengths
+    for (const auto length : lengths)
+        data += static_cast<char>(length);
+
+    return data;
+}
+
+/**
+ * @brief Длины кодов 8 у всех байтов, кроме одного
+ * @param symbol Байт с другой длиной
+ * @param length Его длина
+ * @return Huffman::CodeLengths Длины кодов
+ */
+Huffman::CodeLengths lengthsExcept(unsigned char symbol, unsigned char length)
+{
+    Huffman::CodeLengths lengths;
+    lengths.fill(8);
+    lengths[symbol] = length;
+
+    return lengths;
+}
+}
+
+int main()
+{
+    const std::string sample = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\n\r\n";
+    const std::string message = "GET /about.html HTTP/1.1\r\nHost: example.org\r\n\r\n";
+
+    const auto trained = Huffman::Dictionary::train(sample, 42);
+    const auto saved = trained.serialize();
+    const auto loaded = Huffman::Dictionary::load(saved);
+
+    check(loaded.id() == 42, "loaded id");
+    check(loaded.serialize() == saved, "serialize after load");
+
+    const auto encoded = Huffman::encode(message, loaded);
+    check(encoded == Huffman::encode(message, trained), "loaded dictionary encodes as trained");
+    check(encoded.size() < message.size(), "message is compressed");
+    check(Huffman::dictionaryId(encoded) == 42, "dictionary id of message");
+    check(Huffman::decode(encoded, loaded) == message, "round trip with loaded dictionary");
+    check(Huffman::decode(Huffman::encode("", loaded), loaded).empty(), "empty message");
+
+    // Байты, которых не было в образце, тоже кодируются
+    std::string all;
+    for (unsigned s = 0; s < 256; ++s)
+        all += static_cast<char>(s);
+    check(Huffman::decode(Huffman::encode(all, loaded), loaded) == all, "bytes missing from sample");
+
+    const auto other = Huffman::Dictionary::train(sample, 43);
+    rejects("message for another dictionary", [&] { Huffman::decode(encoded, other); });
+    rejects("truncated message", [&] { Huffman::decode(encoded.substr(0, 2), loaded); });
+
+    // Байт, которого не было в образце "abc", кодируется и декодируется обратно
+    const auto abc = Huffman::Dictionary::load(Huffman::Dictionary::train("abc", 7).serialize());
+    check(Huffman::decode(Huffman::encode("abzzc", abc), abc) == "abzzc", "byte outside the sample");
+
+    // Длины 8 у всех байтов - полный код
+    const auto flat = Huffman::Dictionary::load(blob(lengthsExcept(0, 8)));
+    check(flat.id() == 7, "complete code loads");
+    check(Huffman::decode(Huffman::encode(all, flat), flat) == all, "round trip with complete code");
+
+    // Коды a = 0, b = 10, c = 11 полны, но у остальных байтов кода нет: encode потерял бы их
+    rejects("code for only some bytes", [] { Huffman::Dictionary::load(blob("a\x01" "b\x02" "c\x02")); });
+    rejects("byte without a code", [] { Huffman::Dictionary::load(blob(lengthsExcept('z', 0))); });
+    rejects("under-subscribed code", [] { Huffman::Dictionary::load(blob(lengthsExcept('a', 9))); });
+    rejects("over-subscribed code", [] { Huffman::Dictionary::load(blob(lengthsExcept('a', 7))); });
+    rejects("no codes", [] { Huffman::Dictionary::load(blob("")); });
+
+    // Полный код с длинами 1..31, затем 31 код длины 38 и 194 длины 39 - длиннее предела
+    Huffman::CodeLengths deep;
+    for (unsigned s = 0; s < 256; ++s)
+        deep[s] = static_cast<unsigned char>(s < 31 ? s + 1 : s < 62 ? 38 : 39);
+    rejects("code longer than the limit", [&] { Huffman::Dictionary::load(blob(deep)); });
+    rejects("wrong magic", [&] { Huffman::Dictionary::load("hex" + saved.substr(3)); });
+    rejects("trailing bytes", [&] { Huffman::Dictionary::load(saved + '\0'); });
+    rejects("truncated dictionary", [&] { Huffman::Dictionary::load(saved.substr(0, saved.size() - 1)); });
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+
+    std::cout << "dictionary: all cases ok\n";
+
+    return 0;
+}
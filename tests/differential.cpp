@@ -0,0 +1,454 @@
+#include "huffman.h"
+#include "corpus.h"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Дифференциальная проверка: быстрые пути против эталонных на одних и тех же текстах
+ * Эталон - ядра generic, однопоточное кодирование и декодирование строк целиком, а он сам
+ * сверяется с независимым наивным декодером и оптимальными длинами кодов (Oracle).
+ * Поток байтов от набора ядер, пула, API и нарезки входа не зависит, поэтому закодированный
+ * текст должен совпасть с эталонным байт в байт, а декодированный любым путем - с исходным
+ */
+namespace
+{
+std::size_t failures = 0;
+
+/**
+ * @brief Отметить проверку, при несовпадении - напечатать, что и на чем разошлось
+ * @param ok Результат проверки
+ * @param what Что проверялось
+ * @param name Набор данных и параметры
+ */
+void check(bool ok, const char* what, const std::string& name)
+{
+    if (ok)
+        return;
+
+    ++failures;
+    std::cerr << "FAIL " << what << ": " << name << '\n';
+}
+
+/**
+ * @brief Независимый эталон: наивный разбор потока по описанию формата
+ * Не берет у библиотеки ни одной функции: varint, длины кодов, канонические коды и декодирование
+ * по одному биту через std::map написаны здесь заново. Понимает блоки SingleStreamBlock,
+ * FourStreamBlock, RawBlock и RunBlock, флаг kReuseTableFlag и контрольные суммы блоков
+ */
+class Oracle
+{
+public:
+    // Блок с кодами Хаффмана: его текст и длины кодов, которыми он записан
+    struct CodedBlock
+    {
+        std::string text;
+        std::array<unsigned, 256> lengths;
+        bool ownLengths;
+    };
+
+    /**
+     * @brief Декодировать поток
+     * @param stream Закодированный поток
+     * @param blocks Сюда добавляются блоки с кодами
+     * @return std::string Декодированный текст
+     * @throw std::runtime_error Если поток не разбирается или в нем блок другого типа
+     */
+    static std::string decode(std::string_view stream, std::vector<CodedBlock>& blocks)
+    {
+        if (stream.substr(0, 4) != std::string_view("het\x03", 4))
+            throw std::runtime_error("oracle: not a version 3 stream");
+
+        std::size_t i = 4;
+        const auto size = varint(stream, i);
+        const auto flags = varint(stream, i);
+        const bool checksums = (flags & 2) != 0;
+
+        std::string text;
+        std::array<unsigned, 256> previous{};
+        while (true)
+        {
+            const auto count = static_cast<std::size_t>(varint(stream, i));
+            if (count == 0)
+                break;
+
+            const auto bodySize = static_cast<std::size_t>(varint(stream, i));
+            if (bodySize > stream.size() - i)
+                throw std::runtime_error("oracle: truncated block");
+
+            auto body = stream.substr(i, bodySize);
+            i += bodySize;
+            if (checksums)
+                body.remove_suffix(4);
+
+            const auto type = static_cast<unsigned char>(body[0]);
+            std::size_t at = 1;
+            if (type == 2)
+            {
+                text += body.substr(1, count);
+                continue;
+            }
+
+            if (type == 3)
+            {
+                text.append(count, body[1]);
+                continue;
+            }
+
+            // 0 - один поток, 1 - четыре, старший бит - коды предыдущего блока
+            const bool reuse = (type & 0x80) != 0;
+            const bool interleaved = (type & 0x7F) == 1;
+            if ((type & 0x7F) > 1)
+                throw std::runtime_error("oracle: unsupported block type");
+
+            if (!reuse)
+                previous = lengths(body, at);
+
+            // Границы потоков: размеры первых трех, четвертый - до конца тела
+            std::vector<std::string_view> bits;
+            if (interleaved)
+            {
+                std::size_t sizes[3];
+                for (auto& streamSize : sizes)
+                    streamSize = static_cast<std::size_t>(varint(body, at));
+
+                for (const auto streamSize : sizes)
+                {
+                    bits.push_back(body.substr(at, streamSize));
+                    at += streamSize;
+                }
+            }
+            bits.push_back(body.substr(at));
+
+            // Четверти блока по ceil(count / 4), последняя может быть короче
+            const auto quarter = (count + bits.size() - 1) / bits.size();
+            std::string block;
+            for (std::size_t k = 0; k < bits.size(); ++k)
+            {
+                const auto first = std::min(k * quarter, count);
+                block += decodeBits(bits[k], previous, std::min(first + quarter, count) - first);
+            }
+
+            text += block;
+            blocks.push_back(CodedBlock{ block, previous, !reuse });
+        }
+
+        if (text.size() + 1 != size)
+            throw std::runtime_error("oracle: size in the header does not match");
+
+        return text;
+    }
+
+    /**
+     * @brief Цена кода Хаффмана для частот: сумма весов всех слияний, дерево - на очереди с приоритетом
+     * @param text Текст
+     * @param depth Сюда пишется глубина дерева
+     * @return std::uint64_t Длина текста в битах при оптимальных кодах
+     */
+    static std::uint64_t optimalBits(const std::string& text, unsigned& depth)
+    {
+        std::map<unsigned char, std::uint64_t> counts;
+        for (const auto c : text)
+            ++counts[static_cast<unsigned char>(c)];
+
+        // Узел - вес и глубина поддерева
+        using Node = std::pair<std::uint64_t, unsigned>;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        for (const auto& count : counts)
+            queue.push(Node{ count.second, 0 });
+
+        if (queue.size() == 1)
+        {
+            depth = 1;
+            return queue.top().first;
+        }
+
+        std::uint64_t bits = 0;
+        depth = 0;
+        while (queue.size() > 1)
+        {
+            const auto a = queue.top();
+            queue.pop();
+            const auto b = queue.top();
+            queue.pop();
+
+            bits += a.first + b.first;
+            queue.push(Node{ a.first + b.first, std::max(a.second, b.second) + 1 });
+        }
+
+        depth = queue.top().second;
+        return bits;
+    }
+
+private:
+    static std::uint64_t varint(std::string_view text, std::size_t& i)
+    {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; i < text.size(); shift += 7)
+        {
+            const auto byte = static_cast<unsigned char>(text[i++]);
+            value |= std::uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw std::runtime_error("oracle: truncated number");
+    }
+
+    static std::array<unsigned, 256> lengths(std::string_view body, std::size_t& at)
+    {
+        std::array<unsigned, 256> result{};
+        const auto byte = [&](std::size_t n) { return static_cast<unsigned char>(body.at(at + n)); };
+
+        const auto format = byte(0);
+        ++at;
+        if (format == 0)
+        {
+            const auto n = byte(0);
+            for (std::size_t s = 0; s < n; ++s)
+                result[byte(1 + 2 * s)] = byte(2 + 2 * s);
+
+            at += 1 + 2 * std::size_t(n);
+        }
+        else
+        {
+            for (unsigned s = 0; s < 256; ++s)
+                result[s] = format == 1 ? (byte(s / 2) >> (s % 2 ? 0 : 4)) & 0xF : byte(s);
+
+            at += format == 1 ? 128 : 256;
+        }
+
+        return result;
+    }
+
+    static std::string decodeBits(std::string_view bits, const std::array<unsigned, 256>& lengths, std::size_t count)
+    {
+        // Канонические коды: по возрастанию (длина, символ), следующий код - предыдущий + 1, сдвинутый к длине
+        std::map<std::pair<unsigned, std::uint64_t>, char> codes;
+        std::uint64_t code = 0;
+        unsigned length = 0;
+        for (unsigned l = 1; l <= 32; ++l)
+        {
+            for (unsigned s = 0; s < 256; ++s)
+            {
+                if (lengths[s] != l)
+                    continue;
+
+                code <<= l - length;
+                length = l;
+                codes[{ l, code }] = static_cast<char>(s);
+                ++code;
+            }
+        }
+
+        std::string text;
+        std::size_t bit = 0;
+        while (text.size() < count)
+        {
+            std::uint64_t value = 0;
+            for (unsigned l = 1;; ++l)
+            {
+                if (l > 32 || bit >= 8 * bits.size())
+                    throw std::runtime_error("oracle: invalid code");
+
+                value = value << 1 | ((static_cast<unsigned char>(bits[bit / 8]) >> (7 - bit % 8)) & 1);
+                ++bit;
+
+                const auto found = codes.find({ l, value });
+                if (found != codes.end())
+                {
+                    text += found->second;
+                    break;
+                }
+            }
+        }
+
+        return text;
+    }
+};
+
+/**
+ * @brief Сверить поток с независимым эталоном: декодированный текст и длины кодов
+ * Длины каждого блока со своими кодами должны образовать полный код не длиннее предела,
+ * а если оптимальное дерево в предел помещается - давать ровно оптимальную длину блока
+ * @param text Исходный текст
+ * @param encoded Закодированный текст
+ * @param settings Параметры кодирования
+ * @param name Набор данных и параметры для отчета
+ */
+void compareWithOracle(const std::string& text, const std::string& encoded, const Huffman::Settings& settings, const std::string& name)
+{
+    std::vector<Oracle::CodedBlock> blocks;
+    try
+    {
+        check(Oracle::decode(encoded, blocks) == text, "oracle decode", name);
+    }
+    catch (const std::exception& e)
+    {
+        check(false, e.what(), name);
+        return;
+    }
+
+    for (const auto& block : blocks)
+    {
+        std::uint64_t kraft = 0;
+        std::uint64_t bits = 0;
+        unsigned used = 0;
+        for (unsigned s = 0; s < 256; ++s)
+        {
+            const auto length = block.lengths[s];
+            check(length <= settings.maxCodeLength, "code length within the limit", name);
+            if (length == 0 || length > 32)
+                continue;
+
+            ++used;
+            kraft += std::uint64_t(1) << (32 - length);
+            bits += length * static_cast<std::uint64_t>(std::count(block.text.begin(), block.text.end(), static_cast<char>(s)));
+        }
+
+        check(kraft == std::uint64_t(1) << 32 || (used == 1 && kraft == std::uint64_t(1) << 31), "complete prefix code", name);
+
+        // Коды по выборке и коды предыдущего блока оптимальными для блока быть не обязаны
+        if (!block.ownLengths || settings.sampled)
+            continue;
+
+        unsigned depth = 0;
+        const auto optimal = Oracle::optimalBits(block.text, depth);
+        check(depth <= settings.maxCodeLength ? bits == optimal : bits >= optimal, "optimal code lengths", name);
+    }
+}
+
+/**
+ * @brief Сверить все пути кодирования и декодирования одного текста с эталоном
+ * @param text Текст
+ * @param settings Параметры кодирования
+ * @param pool Пул потоков
+ * @param kernels Наборы ядер, доступные на этом процессоре
+ * @param name Набор данных и параметры для отчета
+ */
+void compare(const std::string& text, const Huffman::Settings& settings, ThreadPool& pool, const std::vector<std::string>& kernels, const std::string& name)
+{
+    Huffman::selectKernels("generic");
+    const auto reference = Huffman::encode(text, settings);
+    check(Huffman::decode(reference) == text, "reference round trip", name);
+    if (settings.order == 0 && settings.symbolWidth == 1)
+        compareWithOracle(text, reference, settings, name);
+
+    for (const auto& kernel : kernels)
+    {
+        Huffman::selectKernels(kernel);
+        const auto tag = name + " kernels=" + kernel;
+
+        check(Huffman::encode(text, settings) == reference, "encode", tag);
+        check(Huffman::encode(text, settings, &pool) == reference, "encode with pool", tag);
+        check(Huffman::decode(reference) == text, "decode", tag);
+        check(Huffman::decode(reference, &pool) == text, "decode with pool", tag);
+
+        Huffman::Context context(settings, &pool);
+        check(context.encode(text) == reference, "context encode", tag);
+        check(context.decode(reference) == text, "context decode", tag);
+
+        std::string buffer(Huffman::maxEncodedSize(text.size(), settings), '\0');
+        const auto encodedSize = context.encode(text, &buffer[0], buffer.size());
+        check(buffer.compare(0, encodedSize, reference) == 0, "context encode into buffer", tag);
+
+        // Буфер на байт меньше: отказ, и байт за его концом не тронут
+        std::string tight(reference.size(), '\x5a');
+        try
+        {
+            context.encode(text, &tight[0], tight.size() - 1);
+            check(false, "context encode into a short buffer", tag);
+        }
+        catch (const std::runtime_error&)
+        {
+            check(tight.back() == '\x5a', "context encode writes past capacity", tag);
+        }
+
+        std::string decoded(text.size(), '\0');
+        check(Huffman::decode(reference, &decoded[0], decoded.size()) == text.size() && decoded == text, "decode into buffer", tag);
+
+        // Потоковые кодировщик и декодировщик с неровной нарезкой входа
+        std::string streamed;
+        Huffman::Encoder encoder(settings, &pool);
+        encoder.setContentSize(text.size());
+        for (std::size_t offset = 0; offset < text.size(); offset += 4099)
+            encoder.update(std::string_view(text).substr(offset, 4099), streamed);
+        encoder.finish(streamed);
+        check(streamed == reference, "streaming encode", tag);
+
+        std::string chunked;
+        Huffman::Decoder decoder(&pool);
+        for (std::size_t offset = 0; offset < reference.size(); offset += 7)
+            decoder.update(std::string_view(reference).substr(offset, 7), chunked);
+        decoder.finish(chunked);
+        check(chunked == text, "streaming decode", tag);
+
+        for (const auto offset : { std::size_t(0), text.size() / 3, text.size() - std::min<std::size_t>(text.size(), 5) })
+        {
+            const auto length = std::min<std::size_t>(text.size() - offset, 70000);
+            check(Huffman::decodeRange(reference, offset, length, &pool) == text.substr(offset, length), "decode range", tag);
+        }
+    }
+}
+}
+
+int main()
+{
+    const auto initial = std::string(Huffman::kernelName());
+    std::vector<std::string> kernels = { "generic" };
+    if (Huffman::selectKernels("bmi2"))
+        kernels.push_back("bmi2");
+
+    ThreadPool pool(4);
+
+    std::vector<std::pair<std::string, Huffman::Settings>> variants;
+    const auto add = [&](const std::string& name, auto&& change)
+    {
+        Huffman::Settings settings;
+        settings.blockSize = std::size_t(1) << 16;
+        change(settings);
+        variants.emplace_back(name, settings);
+    };
+    add("default", [](Huffman::Settings&) {});
+    add("single-stream", [](Huffman::Settings& s) { s.interleaved = false; });
+    add("order1", [](Huffman::Settings& s) { s.order = 1; });
+    add("wide", [](Huffman::Settings& s) { s.symbolWidth = 2; });
+    add("seek-index", [](Huffman::Settings& s) { s.seekIndex = true; });
+    add("sampled", [](Huffman::Settings& s) { s.sampled = true; s.blockSize = std::size_t(1) << 17; });
+    add("checksum", [](Huffman::Settings& s) { s.checksum = true; });
+    add("length8", [](Huffman::Settings& s) { s.maxCodeLength = 8; });
+    add("length32", [](Huffman::Settings& s) { s.maxCodeLength = 32; });
+    add("small-blocks", [](Huffman::Settings& s) { s.blockSize = 1000; s.seekIndex = true; s.checksum = true; });
+
+    for (const auto& corpus : { "random", "zipf", "text", "text2", "single", "all256" })
+    {
+        for (const auto size : { std::size_t(0), std::size_t(1), std::size_t(2), std::size_t(3), std::size_t(1023), std::size_t(1024), std::size_t(70000), std::size_t(300000) })
+        {
+            const auto text = Corpus::generate(corpus, size);
+            for (const auto& variant : variants)
+                compare(text, variant.second, pool, kernels, std::string(corpus) + " size=" + std::to_string(size) + " " + variant.first);
+        }
+    }
+
+    Huffman::selectKernels(initial);
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+
+    std::cout << "differential: all paths match the reference (kernels:";
+    for (const auto& kernel : kernels)
+        std::cout << ' ' << kernel;
+    std::cout << ")\n";
+
+    return 0;
+}
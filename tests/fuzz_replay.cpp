@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Запуск цели фаззера без libFuzzer: для ctest и компиляторов без -fsanitize=fuzzer
+ * Прогоняет через LLVMFuzzerTestOneInput файлы примеров (и все файлы каталогов), затем
+ * заданное число входов, полученных из примеров случайными правками. Входы зависят только
+ * от примеров и зерна, поэтому упавший прогон повторяется точно
+ */
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size);
+
+namespace
+{
+/**
+ * @brief Прогнать один вход
+ * @param input Вход
+ */
+void runOne(const std::string& input)
+{
+    LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+}
+
+/**
+ * @brief Получить новый вход из примера: заменить, вставить или удалить байты, обрезать,
+ * склеить с другим примером
+ * @param seeds Примеры
+ * @param rng Генератор
+ * @return std::string Вход
+ */
+std::string mutate(const std::vector<std::string>& seeds, std::mt19937_64& rng)
+{
+    std::string input = seeds[rng() % seeds.size()];
+    for (auto edits = 1 + rng() % 8; edits > 0; --edits)
+    {
+        const auto at = input.empty() ? 0 : rng() % input.size();
+        switch (rng() % 6)
+        {
+        case 0:
+            if (!input.empty())
+                input[at] = static_cast<char>(rng());
+            break;
+        case 1:
+            input.insert(at, 1 + rng() % 16, static_cast<char>(rng()));
+            break;
+        case 2:
+            input.erase(at, 1 + rng() % 16);
+            break;
+        case 3:
+            input.resize(at);
+            break;
+        case 4:
+        {
+            const auto& other = seeds[rng() % seeds.size()];
+            const auto from = other.empty() ? 0 : rng() % other.size();
+            input.insert(at, other, from, rng() % 4096);
+            break;
+        }
+        default:
+            // Длинный повтор одного байта: блоки RunBlock и коды предыдущего блока
+            input.insert(at, rng() % 20000, static_cast<char>(rng() % 4));
+            break;
+        }
+    }
+
+    // Вход не больше 1 МБ, чтобы прогон оставался быстрым
+    input.resize(std::min<std::size_t>(input.size(), std::size_t(1) << 20));
+
+    return input;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t runs = 1000;
+    std::uint64_t seed = 1;
+    std::vector<std::string> seeds;
+
+    try
+    {
+        for (int a = 1; a < argc; ++a)
+        {
+            const std::string arg = argv[a];
+            if (arg == "--runs" && a + 1 < argc)
+            {
+                runs = std::stoull(argv[++a]);
+                continue;
+            }
+
+            if (arg == "--seed" && a + 1 < argc)
+            {
+                seed = std::stoull(argv[++a]);
+                continue;
+            }
+
+            std::vector<std::filesystem::path> files;
+            if (std::filesystem::is_directory(arg))
+            {
+                for (const auto& entry : std::filesystem::directory_iterator(arg))
+                    if (entry.is_regular_file())
+                        files.push_back(entry.path());
+            }
+            else
+            {
+                files.push_back(arg);
+            }
+
+            for (const auto& file : files)
+            {
+                std::ifstream in(file, std::ios::binary);
+                if (!in)
+                    throw std::runtime_error("Can not open " + file.string() + ".");
+
+                seeds.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "fuzz_replay: " << e.what() << '\n';
+        return 1;
+    }
+
+    // Без примеров - короткие тексты, из которых правки сделают все остальное
+    if (seeds.empty())
+        seeds = { std::string(2, '\0'), std::string("\x01\x00", 2) + "the quick brown fox jumps over the lazy dog" };
+
+    for (const auto& input : seeds)
+        runOne(input);
+
+    std::mt19937_64 rng(seed);
+    for (std::size_t run = 0; run < runs; ++run)
+        runOne(mutate(seeds, rng));
+
+    std::cout << "fuzz_replay: " << seeds.size() << " seeds, " << runs << " generated inputs\n";
+
+    return 0;
+}
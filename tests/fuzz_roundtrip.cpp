@@ -0,0 +1,255 @@
+#include "huffman.h"
+#include "huffman_c.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/**
+ * @brief Цель libFuzzer: круговое кодирование и разбор произвольных потоков
+ * Первые два байта входа выбирают параметры кодирования, остальное - текст.
+ * Текст кодируется и декодируется всеми путями и обоими наборами ядер, результат должен
+ * совпасть с входом, а закодированный текст - с закодированным ядрами generic.
+ * Так же по кругу проходят словарь, обученный на тексте, таблица кодов, построенная
+ * при компиляции, и C-интерфейс.
+ * Затем вход и испорченный закодированный текст разбираются как потоки, сообщения и словари:
+ * разрешено только std::runtime_error (у C-интерфейса - HUFFMAN_ERROR), падение или другое
+ * исключение - ошибка
+ */
+namespace
+{
+/**
+ * @brief Остановить фаззер с сообщением, если проверка не прошла
+ * @param ok Результат проверки
+ * @param what Что проверялось
+ */
+void require(bool ok, const char* what)
+{
+    if (ok)
+        return;
+
+    std::cerr << "fuzz_roundtrip: " << what << '\n';
+    std::abort();
+}
+
+/**
+ * @brief Разобрать данные как закодированный поток всеми путями декодирования
+ * @param data Данные
+ * @param offset Начало диапазона для decodeRange
+ */
+void decodeUntrusted(std::string_view data, std::uint64_t offset)
+{
+    try
+    {
+        Huffman::decode(data);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    try
+    {
+        // Размер из заголовка не доверенный: буфер ограничен, больший поток должен отказать сам
+        const auto size = Huffman::decodedSize(data);
+        std::string out(static_cast<std::size_t>(std::min<std::uint64_t>(size, std::uint64_t(1) << 20)), '\0');
+        Huffman::decode(data, &out[0], out.size());
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    try
+    {
+        Huffman::decodeRange(data, offset, 4096);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+/**
+ * @brief Частоты для таблицы кодов, построенной при компиляции: текст, буквы чаще остальных
+ * @return Huffman::Histogram Частоты
+ */
+constexpr Huffman::Histogram textHistogram()
+{
+    Huffman::Histogram histogram{};
+    for (unsigned s = 0; s < 256; ++s)
+        histogram[s] = s >= 'a' && s <= 'z' ? 100 : s == ' ' ? 200 : 1;
+
+    return histogram;
+}
+
+constexpr Huffman::StaticCode<11> kTextCode(textHistogram());
+
+/**
+ * @brief Словарь, обученный на самом тексте: сообщение по кругу, словарь через serialize/load,
+ * испорченные сообщение и словарь
+ * @param text Текст
+ * @param options Байты параметров, выбирают порчу
+ */
+void dictionaryRoundTrip(std::string_view text, unsigned options)
+{
+    const auto dictionary = Huffman::Dictionary::train(text, options);
+    const auto saved = dictionary.serialize();
+    const auto loaded = Huffman::Dictionary::load(saved);
+    require(loaded.id() == dictionary.id() && loaded.serialize() == saved, "dictionary load differs from saved");
+
+    const auto encoded = Huffman::encode(text, loaded);
+    require(encoded == Huffman::encode(text, dictionary) && Huffman::decode(encoded, dictionary) == text, "dictionary round trip does not match input");
+
+    auto damaged = encoded;
+    damaged[options % damaged.size()] ^= static_cast<char>(1 + (options >> 8) % 255);
+    try
+    {
+        Huffman::decode(damaged, loaded);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    auto damagedDictionary = saved;
+    damagedDictionary[options % damagedDictionary.size()] ^= static_cast<char>(1 + (options >> 8) % 255);
+    for (const auto data : { std::string_view(damagedDictionary), text })
+    {
+        try
+        {
+            const auto untrusted = Huffman::Dictionary::load(data);
+            Huffman::decode(Huffman::encode(text, untrusted), untrusted);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+/**
+ * @brief Таблица кодов, построенная при компиляции: сообщение по кругу и разбор испорченных сообщений
+ * @param text Текст
+ * @param options Байты параметров, выбирают порчу
+ */
+void staticCodeRoundTrip(std::string_view text, unsigned options)
+{
+    const auto encoded = Huffman::encode(text, kTextCode);
+    require(Huffman::decode(encoded, kTextCode) == text, "static code round trip does not match input");
+
+    auto damaged = encoded;
+    damaged[options % damaged.size()] ^= static_cast<char>(1 + (options >> 8) % 255);
+    for (const auto data : { std::string_view(damaged), text })
+    {
+        try
+        {
+            Huffman::decode(data, kTextCode);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+/**
+ * @brief C-интерфейс с теми же параметрами: поток совпадает с encode, мелкий буфер и порча дают коды ошибок
+ * @param text Текст
+ * @param settings Параметры кодирования
+ * @param encoded Текст, закодированный encode с этими параметрами
+ * @param options Байты параметров, выбирают порчу
+ */
+void cApiRoundTrip(std::string_view text, const Huffman::Settings& settings, const std::string& encoded, unsigned options)
+{
+    std::unique_ptr<huffman_context, void (*)(huffman_context*)> context(huffman_context_create(), huffman_context_destroy);
+    require(context != nullptr, "huffman_context_create failed");
+
+    const auto set = [&](huffman_option option, std::int64_t value) { require(huffman_set_option(context.get(), option, value) == HUFFMAN_OK, "huffman_set_option failed"); };
+    set(HUFFMAN_OPTION_BLOCK_SIZE, static_cast<std::int64_t>(settings.blockSize));
+    set(HUFFMAN_OPTION_MAX_CODE_LENGTH, settings.maxCodeLength);
+    set(HUFFMAN_OPTION_INTERLEAVED, settings.interleaved);
+    set(HUFFMAN_OPTION_ORDER, settings.order);
+    set(HUFFMAN_OPTION_SYMBOL_WIDTH, settings.symbolWidth);
+    set(HUFFMAN_OPTION_SEEK_INDEX, settings.seekIndex);
+    set(HUFFMAN_OPTION_SAMPLED, settings.sampled);
+    set(HUFFMAN_OPTION_CHECKSUM, settings.checksum);
+
+    std::string buffer(huffman_max_encoded_size(context.get(), text.size()), '\0');
+    std::size_t written = 0;
+    require(huffman_encode(context.get(), text.data(), text.size(), &buffer[0], buffer.size(), &written) == HUFFMAN_OK, "huffman_encode failed");
+    require(buffer.compare(0, written, encoded) == 0 && written == encoded.size(), "huffman_encode differs from encode");
+
+    require(huffman_encode(context.get(), text.data(), text.size(), &buffer[0], written - 1, &written) == HUFFMAN_BUFFER_TOO_SMALL && written == encoded.size(), "huffman_encode into a small buffer");
+
+    std::string decoded(text.size(), '\0');
+    require(huffman_decode(context.get(), encoded.data(), encoded.size(), &decoded[0], decoded.size(), &written) == HUFFMAN_OK && written == text.size() && decoded == text, "huffman_decode does not match input");
+    if (!text.empty())
+        require(huffman_decode(context.get(), encoded.data(), encoded.size(), &decoded[0], text.size() - 1, &written) == HUFFMAN_BUFFER_TOO_SMALL && written == text.size(), "huffman_decode into a small buffer");
+
+    auto damaged = encoded;
+    damaged[options % damaged.size()] ^= static_cast<char>(1 + (options >> 8) % 255);
+    std::string out(std::size_t(1) << 16, '\0');
+    for (const auto data : { std::string_view(damaged), text })
+    {
+        const auto status = huffman_decode(context.get(), data.data(), data.size(), &out[0], out.size(), &written);
+        require(status == HUFFMAN_OK || status == HUFFMAN_ERROR || status == HUFFMAN_BUFFER_TOO_SMALL, "huffman_decode returned an unknown status");
+        require(status != HUFFMAN_ERROR || huffman_last_error(context.get())[0] != '\0', "huffman_decode failed without an error text");
+    }
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    if (size < 2)
+        return 0;
+
+    const auto options = static_cast<unsigned>(data[0]) | static_cast<unsigned>(data[1]) << 8;
+    const std::string_view text(reinterpret_cast<const char*>(data) + 2, size - 2);
+
+    Huffman::Settings settings;
+    settings.interleaved = (options & 1) != 0;
+    settings.order = (options >> 1) & 1;
+    settings.symbolWidth = (options >> 2) & 1 ? 2 : 1;
+    settings.seekIndex = (options >> 3) & 1;
+    settings.sampled = (options >> 4) & 1;
+    settings.checksum = (options >> 5) & 1;
+    settings.maxCodeLength = Huffman::kMinCodeLengthLimit + ((options >> 6) & 0x1F) % (Huffman::kMaxCodeLengthLimit - Huffman::kMinCodeLengthLimit + 1);
+    // Маленькие блоки, чтобы даже короткий вход давал несколько блоков и коды предыдущего блока
+    settings.blockSize = std::size_t(64) << ((options >> 11) & 7);
+
+    const auto encoded = Huffman::encode(text, settings);
+    require(encoded.size() <= Huffman::maxEncodedSize(text.size(), settings), "encoded size exceeds maxEncodedSize");
+    require(Huffman::decode(encoded) == text, "decode does not match input");
+
+    // Эталон для быстрых ядер - ядра generic: поток байтов от набора ядер не зависит
+    const std::string active = Huffman::kernelName();
+    Huffman::selectKernels("generic");
+    const auto reference = Huffman::encode(text, settings);
+    const auto referenceDecoded = Huffman::decode(encoded);
+    Huffman::selectKernels(active);
+    require(reference == encoded && referenceDecoded == text, "fast kernels differ from generic kernels");
+
+    thread_local Huffman::Context context;
+    context.reset(settings);
+    require(context.encode(text) == encoded, "context encode differs from encode");
+
+    std::string decoded(text.size(), '\0');
+    require(context.decode(encoded, &decoded[0], decoded.size()) == text.size() && decoded == text, "decode into buffer does not match input");
+
+    if (!text.empty())
+    {
+        const auto offset = options % text.size();
+        const auto length = std::min<std::size_t>(text.size() - offset, 1000);
+        require(Huffman::decodeRange(encoded, offset, length) == text.substr(offset, length), "decodeRange does not match input");
+    }
+
+    // Порча одного байта закодированного текста: декодер отказывает или возвращает какой-то текст
+    auto damaged = encoded;
+    damaged[options % damaged.size()] ^= static_cast<char>(1 + (options >> 8) % 255);
+    decodeUntrusted(damaged, options);
+    decodeUntrusted(text, options);
+
+    dictionaryRoundTrip(text, options);
+    staticCodeRoundTrip(text, options);
+    cApiRoundTrip(text, settings, encoded, options);
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include "huffman.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Таблица кодов, построенная при компиляции, против кодов, построенных при работе
+ * Свойства кодов (полнота, каноничность, предел длины) проверяются static_assert на самой
+ * constexpr-таблице. При работе коды сверяются с generateCanonicalCodes через словарь
+ * с теми же длинами, а длины - по стоимости с деревом Dictionary::train
+ */
+namespace
+{
+std::size_t failures = 0;
+
+/**
+ * @brief Отметить проверку, при несовпадении - напечатать, что не прошло
+ * @param ok Результат проверки
+ * @param what Что проверялось
+ */
+void check(bool ok, const char* what)
+{
+    if (ok)
+        return;
+
+    ++failures;
+    std::cerr << "FAIL " << what << '\n';
+}
+
+/**
+ * @brief Частоты поля протокола: буквы по закону Ципфа, цифры, остальные байты редки
+ * @param top Частота самой частой буквы 'A'
+ * @return Huffman::Histogram Частоты
+ */
+constexpr Huffman::Histogram fieldHistogram(std::uint64_t top)
+{
+    Huffman::Histogram histogram{};
+    for (unsigned s = 0; s < 256; ++s)
+        histogram[s] = 10;
+
+    for (unsigned s = 'A'; s <= 'Z'; ++s)
+        histogram[s] = top / (s - 'A' + 1);
+
+    for (unsigned s = '0'; s <= '9'; ++s)
+        histogram[s] = top / 10;
+
+    return histogram;
+}
+
+/**
+ * @brief Сумма Крафта в единицах 2^-MaxCodeLength: у полного кода ровно 2^MaxCodeLength
+ * @param code Таблица кодов
+ * @return std::uint64_t Сумма
+ */
+template <unsigned MaxCodeLength>
+constexpr std::uint64_t kraft(const Huffman::StaticCode<MaxCodeLength>& code)
+{
+    std::uint64_t sum = 0;
+    for (unsigned s = 0; s < 256; ++s)
+        sum += code.code(static_cast<unsigned char>(s)).length ? std::uint64_t(1) << (MaxCodeLength - code.code(static_cast<unsigned char>(s)).length) : 0;
+
+    return sum;
+}
+
+/**
+ * @brief Каноничны ли коды: по (длине, символу) коды, выровненные влево, идут подряд без пропусков
+ * @param code Таблица кодов
+ * @return true Если каноничны и каждый код не длиннее MaxCodeLength
+ */
+template <unsigned MaxCodeLength>
+constexpr bool canonical(const Huffman::StaticCode<MaxCodeLength>& code)
+{
+    std::uint64_t next = 0;
+    for (unsigned length = 1; length <= MaxCodeLength; ++length)
+    {
+        for (unsigned s = 0; s < 256; ++s)
+        {
+            const auto c = code.code(static_cast<unsigned char>(s));
+            if (c.length > MaxCodeLength || c.length == 0)
+                return false;
+
+            if (c.length != length)
+                continue;
+
+            if (std::uint64_t(c.bits) << (MaxCodeLength - length) != next)
+                return false;
+
+            next += std::uint64_t(1) << (MaxCodeLength - length);
+        }
+    }
+
+    return next == std::uint64_t(1) << MaxCodeLength;
+}
+
+// Пологое распределение: предел 11 не мешает. Крутое: дерево длиннее 8, частоты сглаживаются
+constexpr Huffman::StaticCode<11> kFieldCode(fieldHistogram(1000));
+constexpr Huffman::StaticCode<8> kLimitedCode(fieldHistogram(std::uint64_t(1) << 30));
+
+static_assert(kraft(kFieldCode) == 1u << 11 && canonical(kFieldCode), "Static code must be a complete canonical prefix code.");
+static_assert(kraft(kLimitedCode) == 1u << 8 && canonical(kLimitedCode), "Limited static code must be a complete canonical prefix code.");
+static_assert(kFieldCode.code('A').length < kFieldCode.code('Z').length, "Frequent bytes get shorter codes.");
+static_assert(kFieldCode.code('A').bits == 0, "The most frequent byte gets the all-zero code.");
+static_assert(kFieldCode.code('\xff').length > 0, "Bytes missing from the histogram still get a code.");
+
+/**
+ * @brief Текст, в котором каждый байт встречается histogram[s] + 1 раз
+ * Его длина в битах - ровно та стоимость, которую минимизирует дерево по частотам + 1
+ * @param histogram Частоты
+ * @return std::string Текст
+ */
+std::string weightedText(const Huffman::Histogram& histogram)
+{
+    std::string text;
+    for (unsigned s = 0; s < 256; ++s)
+        text.append(static_cast<std::size_t>(histogram[s] + 1), static_cast<char>(s));
+
+    return text;
+}
+
+/**
+ * @brief Сверить таблицу с кодами, которые строит для тех же длин библиотека при работе
+ * Словарь загружается из длин таблицы (ByteLengths), поэтому его коды строит generateCanonicalCodes,
+ * и битовый поток сообщения должен совпасть с потоком таблицы бит в бит
+ * @param code Таблица кодов
+ * @param text Текст сообщения
+ * @param name Название случая
+ */
+template <unsigned MaxCodeLength>
+void compareWithDictionary(const Huffman::StaticCode<MaxCodeLength>& code, const std::string& text, const char* name)
+{
+    std::string blob = "hed";
+    blob += '\x01'; // номер словаря
+    blob += '\x02'; // ByteLengths
+    for (unsigned s = 0; s < 256; ++s)
+        blob += static_cast<char>(code.code(static_cast<unsigned char>(s)).length);
+
+    const auto dictionary = Huffman::Dictionary::load(blob);
+    const auto byDictionary = Huffman::encode(text, dictionary);
+    const auto byTable = Huffman::encode(text, code);
+
+    // Сообщение словаря - номер (один байт) и то же, что сообщение таблицы
+    check(byDictionary.substr(1) == byTable, name);
+}
+}
+
+int main()
+{
+    const std::string message = "HELLO WORLD 0123456789 THE QUICK BROWN FOX";
+
+    const auto encoded = Huffman::encode(message, kFieldCode);
+    check(Huffman::decode(encoded, kFieldCode) == message, "round trip");
+    check(encoded.size() < message.size(), "message is compressed");
+    check(Huffman::decode(Huffman::encode(message, kLimitedCode), kLimitedCode) == message, "round trip with limited code");
+    check(Huffman::decode(Huffman::encode("", kFieldCode), kFieldCode).empty(), "empty message");
+
+    std::string all;
+    for (unsigned s = 0; s < 256; ++s)
+        all += static_cast<char>(s);
+    check(Huffman::decode(Huffman::encode(all, kFieldCode), kFieldCode) == all, "bytes missing from histogram");
+
+    compareWithDictionary(kFieldCode, all + message, "canonical codes match generateCanonicalCodes");
+    compareWithDictionary(kLimitedCode, all + message, "limited canonical codes match generateCanonicalCodes");
+
+    // Без ограничения длины оба построения - деревья Хаффмана по частотам + 1, стоимость одна
+    unsigned maxLength = 0;
+    for (unsigned s = 0; s < 256; ++s)
+        maxLength = std::max<unsigned>(maxLength, kFieldCode.code(static_cast<unsigned char>(s)).length);
+    check(maxLength < 11, "field histogram needs no length limit");
+
+    const auto text = weightedText(fieldHistogram(1000));
+    const auto trained = Huffman::Dictionary::train(fieldHistogram(1000), 1, 11);
+    check(Huffman::encode(text, trained).size() == 1 + Huffman::encode(text, kFieldCode).size(), "tree cost matches Dictionary::train");
+
+    // Поврежденные сообщения: длина больше, чем может дать поток, и оборванная длина
+    try
+    {
+        Huffman::decode(std::string("\x7f\x00", 2), kFieldCode);
+        check(false, "count beyond the stream");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    try
+    {
+        Huffman::decode(std::string("\x80", 1), kFieldCode);
+        check(false, "truncated count");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+
+    std::cout << "static_code: all cases ok\n";
+
+    return 0;
+}